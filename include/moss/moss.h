@@ -36,6 +36,11 @@
  * @{
  */
 
+#ifndef MOSS_CACHELINE_SIZE
+/** Cache line size to keep data from different cores apart. */
+#define MOSS_CACHELINE_SIZE 64
+#endif
+
 /** Minimal. */
 #define MOSS_MIN(_a, _b) ((_a) <= (_b) ? (_a) : (_b))
 
@@ -144,6 +149,12 @@ typedef struct moss_tailq_entry_rec {
 /** Head to tail queue. */
 typedef TAILQ_HEAD(moss_tailq_rec, moss_tailq_entry_rec) moss_tailq_t;
 
+/** Memory segment, layout compatible to struct iovec. */
+typedef struct moss_iov_rec {
+	void *iov_base; /**< Start of the segment. */
+	size_t iov_len; /**< Size of the segment. */
+} moss_iov_t;
+
 /** Strip characters from start of string. */
 size_t moss_stripl(const void **buf, size_t sz, const char *ext);
 
@@ -158,6 +169,56 @@ size_t moss_stripl(const void **buf, size_t sz, const char *ext);
 /** @addtogroup MOSS_BUF
  * @{
  */
+/** Build time power of 2 capable for all moss buffer.
+ *
+ * Non-zero to wrap with mask only, and run moss_buf_spsc_t on free-running
+ * index.  All capable must be power of 2, moss_buf_init() reject others,
+ * segment and mirrored data memory round up.
+ */
+#ifndef MOSS_BUF_POW2
+#define MOSS_BUF_POW2 0
+#endif
+
+/** Build time switch for moss buffer statistics.
+ *
+ * Zero to compile out all statistics.
+ */
+#ifndef MOSS_BUF_STATS
+#define MOSS_BUF_STATS 0
+#endif
+
+#if MOSS_BUF_STATS
+/** Buckets of transfer size histogram. */
+#define MOSS_BUF_STATS_HIST 16
+
+/** Statistics for moss buffer.
+ *
+ * Counters update with relaxed atomic, snapshot with moss_buf_stats_get()
+ * without stop traffic.
+ */
+typedef struct moss_buf_stats_rec {
+	unsigned long long wr, /**< Bytes written. */
+			rd; /**< Bytes read. */
+	size_t hiwat; /**< High water mark of valid data. */
+	unsigned long short_wr; /**< Count of write not fully taken. */
+
+	/** Count of transfer, bucket n for size in [2^n, 2^(n+1)), the last
+	 * bucket includes all larger. */
+	unsigned long hist[MOSS_BUF_STATS_HIST];
+} moss_buf_stats_t;
+#endif
+
+/** Flags for moss buffer. */
+typedef enum moss_buf_flag_enum {
+	/** Data memory mapped twice back to back, any range up to cap bytes from
+	 * the data position is contiguous. */
+	moss_buf_flag_mirror = (1 << 0),
+
+	/** Capable is power of 2, wrap with mask.  Set by moss_buf_init(), do
+	 * not set on other capable. */
+	moss_buf_flag_pow2 = (1 << 1),
+} moss_buf_flag_t;
+
 /** moss buffer data structure. */
 typedef struct moss_buf_rec {
 	size_t pos, /**< Current data position of the data memory. */
@@ -165,32 +226,296 @@ typedef struct moss_buf_rec {
 			lmt; /**< Valid data range. */
 	void *data; /**< Pointer to data memory. */
 	moss_memcpy_t memcpy;
+	unsigned flag; /**< moss_buf_flag_t */
+#if MOSS_BUF_STATS
+	moss_buf_stats_t *stats; /**< Statistics, NULL to skip. */
+#endif
 } moss_buf_t;
 
-int moss_buf_write(moss_buf_t *buf, const void *data, size_t sz);
+#if MOSS_BUF_STATS
+/** Snapshot statistics of moss buffer.
+ *
+ * @param buf
+ * @param stats Receive the snapshot.
+ * @return 0 when success, others when statistics not attached.
+ */
+int moss_buf_stats_get(moss_buf_t *buf, moss_buf_stats_t *stats);
+
+/** Clear statistics of moss buffer, high water mark restart from lmt. */
+void moss_buf_stats_reset(moss_buf_t *buf);
+#endif
+
+/** Initialize moss buffer.
+ *
+ * Check the capable once, moss_buf_flag_pow2 set when power of 2.
+ *
+ * @param buf
+ * @param data
+ * @param cap
+ * @param flag moss_buf_flag_t
+ * @return 0 when success, others when capable not power of 2 for
+ *   moss_buf_flag_pow2 or MOSS_BUF_POW2.
+ */
+int moss_buf_init(moss_buf_t *buf, void *data, size_t cap, unsigned flag);
+
+/** Write memory to moss buffer.
+ *
+ * @param buf
+ * @param data
+ * @param sz
+ * @return Bytes not written due to insufficient space.
+ */
+size_t moss_buf_write(moss_buf_t *buf, const void *data, size_t sz);
 
 /** Read from moss buffer to mempry.
  *
  * @param buf
  * @param data
  * @param sz
- * @return
+ * @return Bytes read.
+ */
+size_t moss_buf_read(moss_buf_t *buf, void *data, size_t sz);
+
+/** Reserve free space of moss buffer for zero-copy write.
+ *
+ * Reserved space is one or two segments, the second one presents when the
+ * space cross the end of data memory.  Fill the segments then
+ * moss_buf_commit() to append to valid data.
+ *
+ * Example:
+ * @code{.c}
+ * moss_iov_t iov[2];
+ * int iov_cnt = moss_buf_reserve(buf, buf->cap, iov);
+ * ssize_t r = readv(fd, (struct iovec*)iov, iov_cnt);
+ * if (r > 0) moss_buf_commit(buf, r);
+ * @endcode
+ *
+ * @param buf
+ * @param sz Size to reserve, limited to the free space.
+ * @param iov Array of 2 to receive the reserved segments.
+ * @return Count of segments.
+ */
+int moss_buf_reserve(moss_buf_t *buf, size_t sz, moss_iov_t *iov);
+
+/** Append reserved space to valid data.
+ *
+ * @param buf
+ * @param sz
+ * @return Bytes appended.
+ */
+size_t moss_buf_commit(moss_buf_t *buf, size_t sz);
+
+/** Get valid data of moss buffer for zero-copy read.
+ *
+ * Valid data is one or two segments, the second one presents when the data
+ * cross the end of data memory.  Use the segments then moss_buf_consume() to
+ * drop from valid data.
+ *
+ * @param buf
+ * @param iov Array of 2 to receive the valid data segments.
+ * @return Count of segments.
+ */
+int moss_buf_peek(moss_buf_t *buf, moss_iov_t *iov);
+
+/** Drop data from the start of valid data.
+ *
+ * @param buf
+ * @param sz
+ * @return Bytes dropped.
+ */
+size_t moss_buf_consume(moss_buf_t *buf, size_t sz);
+
+/** Lock-free single producer single consumer moss buffer.
+ *
+ * One producer thread write and one consumer thread read without external
+ * lock.  The producer owns head, the consumer owns tail, each sit on separate
+ * cache line and published with release/acquire order.  Both index run in
+ * [0, 2 * cap) to tell full from empty without spare byte, or free-running
+ * when MOSS_BUF_POW2 which require cap power of 2.
+ *
+ * Example:
+ * @code{.c}
+ * char mem[1024];
+ * moss_buf_spsc_t spsc = {.data = mem, .cap = sizeof(mem)};
+ * @endcode
+ */
+typedef struct moss_buf_spsc_rec {
+	size_t cap; /**< Total capable of the data memory. */
+	void *data; /**< Pointer to data memory. */
+	moss_memcpy_t memcpy;
+
+	/** Write index, updated by producer. */
+	size_t head __attribute__((aligned(MOSS_CACHELINE_SIZE)));
+	size_t tail_cache; /**< Producer copy of tail. */
+
+	/** Read index, updated by consumer. */
+	size_t tail __attribute__((aligned(MOSS_CACHELINE_SIZE)));
+	size_t head_cache; /**< Consumer copy of head. */
+} moss_buf_spsc_t;
+
+/** Write to single producer single consumer buffer.
+ *
+ * Called by producer only.
+ *
+ * @param buf
+ * @param data
+ * @param sz
+ * @return Bytes not written due to insufficient space.
+ */
+size_t moss_buf_spsc_write(moss_buf_spsc_t *buf, const void *data, size_t sz);
+
+/** Read from single producer single consumer buffer.
+ *
+ * Called by consumer only.
+ *
+ * @param buf
+ * @param data
+ * @param sz
+ * @return Bytes read.
+ */
+size_t moss_buf_spsc_read(moss_buf_spsc_t *buf, void *data, size_t sz);
+
+/** Valid data size in single producer single consumer buffer.
+ *
+ * Snapshot, could be called from either side.
+ */
+size_t moss_buf_spsc_lmt(moss_buf_spsc_t *buf);
+
+/** Copy descriptor for asynchronous copy engine. */
+typedef struct moss_copy_rec {
+	moss_tailq_entry_t qent; /**< Engine private queue entry. */
+	void *tgt;
+	const void *src;
+	size_t sz;
+	int done; /**< Engine set non-zero with release order on completion. */
+} moss_copy_t;
+
+/** Asynchronous copy engine.
+ *
+ * Platform provide the engine, ie. DMA controller on mkr/mmw set done from
+ * the transfer complete interrupt, or worker thread on pc.
+ */
+typedef struct moss_copy_engine_rec {
+	/** Queue all or none of the copies, complete in submission order.
+	 *
+	 * Return 0 when success, others when failure.
+	 */
+	int (*submit)(struct moss_copy_engine_rec*, moss_copy_t *cp, int cnt);
+	void *priv;
+} moss_copy_engine_t;
+
+/** Asynchronous transfer between memory and moss buffer. */
+typedef struct moss_buf_xfer_rec {
+	moss_tailq_entry_t qent;
+	moss_copy_t cp[2];
+	int cp_cnt;
+	size_t sz; /**< Bytes to transfer. */
+	void (*cb)(struct moss_buf_xfer_rec*); /**< Called from moss_buf_async_poll(). */
+	void *arg;
+} moss_buf_xfer_t;
+
+/** moss buffer driven by asynchronous copy engine.
+ *
+ * Several transfers could be in flight.  Valid data (lmt) and data position
+ * (pos) of the moss buffer advance only when moss_buf_async_poll() found the
+ * transfer completed, do not mix with synchronous access to the moss buffer.
+ *
+ * Example:
+ * @code{.c}
+ * moss_buf_async_t abuf;
+ * moss_buf_xfer_t xfer = {.cb = &on_written};
+ *
+ * MOSS_BUF_ASYNC_INIT(&abuf, &buf, &engine);
+ * moss_buf_write_submit(&abuf, &xfer, data, sz);
+ * while (moss_buf_async_poll(&abuf) <= 0) ...;
+ * @endcode
+ */
+typedef struct moss_buf_async_rec {
+	moss_buf_t *buf;
+	moss_copy_engine_t *engine;
+	size_t wpend, /**< Bytes in flight to write. */
+			rpend; /**< Bytes in flight to read. */
+	moss_tailq_t wq, rq;
+} moss_buf_async_t;
+
+/** Initialize asynchronous moss buffer. */
+#define MOSS_BUF_ASYNC_INIT(_abuf, _buf, _engine) do { \
+	memset(_abuf, 0, sizeof(*(_abuf))); \
+	(_abuf)->buf = _buf; \
+	(_abuf)->engine = _engine; \
+	TAILQ_INIT(&(_abuf)->wq); \
+	TAILQ_INIT(&(_abuf)->rq); \
+} while(0)
+
+/** Submit write from memory to moss buffer.
+ *
+ * @param abuf
+ * @param xfer Keep until completion.
+ * @param data
+ * @param sz
+ * @return Bytes not submitted due to insufficient space, -1 when engine
+ *   failure.
+ */
+int moss_buf_write_submit(moss_buf_async_t *abuf, moss_buf_xfer_t *xfer,
+		const void *data, size_t sz);
+
+/** Submit read from moss buffer to memory.
+ *
+ * @param abuf
+ * @param xfer Keep until completion.
+ * @param data
+ * @param sz
+ * @return Bytes submitted, -1 when engine failure.
  */
-int moss_buf_read(moss_buf_t *buf, void *data, size_t sz);
+int moss_buf_read_submit(moss_buf_async_t *abuf, moss_buf_xfer_t *xfer,
+		void *data, size_t sz);
+
+/** Reap completed transfers in submission order.
+ *
+ * Advance the moss buffer and call the transfer callback.
+ *
+ * @param abuf
+ * @return Count of completed transfers.
+ */
+int moss_buf_async_poll(moss_buf_async_t *abuf);
 
 /** Expand moss buffer capable.
+ *
+ * - Grow at least double of the current capable.
+ * - Data memory should come from malloc().
+ * - When retain, try realloc() in place and keep valid data, move the
+ *   smaller segment when the data cross the end of former data memory.
  *
  * @param buf
  * @param cap
  * @param retain
- * @return 0 when success, others when failure.
+ * @return 0 when success, others when failure (always fail for
+ *   moss_buf_flag_mirror).
  */
 int moss_buf_expand(moss_buf_t *buf, size_t cap, int retain);
 
+/** Shrink moss buffer capable after burst.
+ *
+ * Take effect when valid data fall under quarter of capable, move valid data
+ * to the start of data memory and realloc() to twice of the valid data, but
+ * not less then lowat.
+ *
+ * @param buf
+ * @param lowat Low water mark of capable.
+ * @return 0 when success, others when failure (always fail for
+ *   moss_buf_flag_mirror).
+ */
+int moss_buf_shrink(moss_buf_t *buf, size_t lowat);
+
 /** Printf to moss buffer.
  *
  * - Assume valid data occupied buf->lmt bytes from buf->pos.
  * - Printf from buf->pos + buf->lmt and append trailing 0.
+ * - When the text cross the end of data memory, printf to the free space at
+ *   the start of data memory and move the leading part to the end, or
+ *   printf aside (stack memory for short text) and copy to both part when
+ *   not enough space there.  Valid data and position never move, the text is
+ *   always appended in ring order.
  * - After printf successful, add the size of written character(no count
  *   trailing 0) to buf->lmt.
  * - If printf failed, restore the first character after original valid data
@@ -215,6 +540,147 @@ int moss_buf_vprintf(moss_buf_t *buf, const char *fmt, va_list va)
 int moss_buf_printf(moss_buf_t *buf, const char *fmt, ...)
 		__attribute__((format(printf, 2, 3)));
 
+/** Alignment for record in moss buffer.
+ *
+ * Capable and data memory should align to it for record layer.
+ */
+#define MOSS_BUF_MSG_ALIGN sizeof(uint32_t)
+
+/** Push records to moss buffer.
+ *
+ * Record layer on top of moss buffer, each record is 32 bits length followed
+ * by the body, padded to MOSS_BUF_MSG_ALIGN.  Record never cross the end of
+ * data memory, the space left at the end of data memory is marked skipped.
+ * The body is the header concatenated with the payload.
+ *
+ * @param buf
+ * @param hdr Array of cnt headers, NULL for no header.
+ * @param payload Array of cnt payloads, NULL for no payload.
+ * @param cnt
+ * @return Count of records pushed, stop at the first insufficient space.
+ */
+int moss_buf_msg_push(moss_buf_t *buf, const moss_iov_t *hdr,
+		const moss_iov_t *payload, int cnt);
+
+/** Pop records from moss buffer.
+ *
+ * Get contiguous body of records and drop them from moss buffer, the body
+ * stay valid until next push.  Stop at the record which length run out of
+ * valid data, the rest left in moss buffer.
+ *
+ * @param buf
+ * @param msg Array of cnt to receive the body.
+ * @param cnt
+ * @return Count of records.
+ */
+int moss_buf_msg_pop(moss_buf_t *buf, moss_iov_t *msg, int cnt);
+
+/** Peek records in moss buffer.
+ *
+ * Reference to moss_buf_msg_pop(), but keep the records.
+ */
+int moss_buf_msg_peek(moss_buf_t *buf, moss_iov_t *msg, int cnt);
+
+/** Segment of moss buffer chain. */
+typedef struct moss_buf_seg_rec {
+	moss_tailq_entry_t qent;
+	moss_buf_t buf;
+	/** Release the segment when drained, NULL to keep. */
+	void (*free)(struct moss_buf_seg_rec*);
+} moss_buf_seg_t;
+
+/** Chain of moss buffer segments.
+ *
+ * Append and prepend without bound, move whole segments between chain
+ * without copy.
+ *
+ * Example:
+ * @code{.c}
+ * moss_buf_chain_t pkt;
+ *
+ * MOSS_BUF_CHAIN_INIT(&pkt, 2048);
+ * moss_buf_chain_append(&pkt, payload, payload_sz);
+ * moss_buf_chain_prepend(&pkt, &hdr, sizeof(hdr));
+ * moss_buf_chain_splice(&tx, &pkt);
+ * @endcode
+ */
+typedef struct moss_buf_chain_rec {
+	moss_tailq_t segs;
+	size_t lmt; /**< Valid data in all segments. */
+	size_t seg_cap; /**< Minimal capable to allocate segment. */
+} moss_buf_chain_t;
+
+/** Initialize moss buffer chain. */
+#define MOSS_BUF_CHAIN_INIT(_chain, _seg_cap) do { \
+	TAILQ_INIT(&(_chain)->segs); \
+	(_chain)->lmt = 0; \
+	(_chain)->seg_cap = _seg_cap; \
+} while(0)
+
+/** Allocate segment with data memory in one block.
+ *
+ * @param cap
+ * @return NULL when failure.
+ */
+moss_buf_seg_t *moss_buf_seg_alloc(size_t cap);
+
+/** Add segment to moss buffer chain without copy.
+ *
+ * @param chain
+ * @param seg
+ * @param head Non-zero to add before all segments.
+ */
+void moss_buf_chain_add(moss_buf_chain_t *chain, moss_buf_seg_t *seg,
+		int head);
+
+/** Append to moss buffer chain.
+ *
+ * Fill the free space of the last segment then allocate new one.
+ *
+ * @param chain
+ * @param data
+ * @param sz
+ * @return 0 when success, others when failure.
+ */
+int moss_buf_chain_append(moss_buf_chain_t *chain, const void *data,
+		size_t sz);
+
+/** Prepend to moss buffer chain.
+ *
+ * Fill the free space before valid data of the first segment then allocate
+ * new one.
+ *
+ * @param chain
+ * @param data
+ * @param sz
+ * @return 0 when success, others when failure.
+ */
+int moss_buf_chain_prepend(moss_buf_chain_t *chain, const void *data,
+		size_t sz);
+
+/** Move all segments to the end of another moss buffer chain. */
+void moss_buf_chain_splice(moss_buf_chain_t *chain, moss_buf_chain_t *src);
+
+/** Read from moss buffer chain to memory.
+ *
+ * @param chain
+ * @param data
+ * @param sz
+ * @return Bytes read.
+ */
+size_t moss_buf_chain_read(moss_buf_chain_t *chain, void *data, size_t sz);
+
+/** Drop data from the start of moss buffer chain.
+ *
+ * @param chain
+ * @param sz
+ * @return Bytes dropped.
+ */
+size_t moss_buf_chain_drain(moss_buf_chain_t *chain, size_t sz);
+
+/** Drop all data and segments. */
+void moss_buf_chain_free(moss_buf_chain_t *chain);
+
 /** @} MOSS_BUF */
 
 /** @defgroup MOSS_LOG
@@ -253,6 +719,22 @@ typedef enum moss_log_level_enum {
  */
 extern int moss_logt(moss_buf_t *buf, unsigned flag, const char *tag, long lno);
 
+/** Get timestamp for message log.
+ *
+ * @return Microseconds since epoch, 0 when not available.
+ */
+extern unsigned long long moss_log_ts(void);
+
+/** Provide timestamp string from moss_log_ts().
+ *
+ * Same format to moss_logt().
+ *
+ * @param buf
+ * @param ts
+ * @return 0 when success, others when failure.
+ */
+extern int moss_log_ts_str(moss_buf_t *buf, unsigned long long ts);
+
 /** Format the message log.
  *
  * @param buf
@@ -266,6 +748,25 @@ extern int moss_logt(moss_buf_t *buf, unsigned flag, const char *tag, long lno);
 int moss_vlogf(moss_buf_t *buf, unsigned flag, const char *tag, long lno,
 		const char *fmt, va_list va) __attribute__((format(printf, 5, 0)));
 
+/** Format the message log, expand buffer for long message.
+ *
+ * Start with the data memory from the caller, which is never released.
+ * When insufficient, format again to larger memory from malloc() up to
+ * cap_max, the caller should free() buf->data when changed.
+ *
+ * @param buf
+ * @param cap_max
+ * @param flag
+ * @param tag
+ * @param lno
+ * @param fmt
+ * @param va
+ * @return
+ */
+int moss_vlogf_expand(moss_buf_t *buf, size_t cap_max, unsigned flag,
+		const char *tag, long lno, const char *fmt, va_list va)
+		__attribute__((format(printf, 6, 0)));
+
 /** Format the message log.
  *
  *
@@ -279,9 +780,61 @@ int moss_vlogf(moss_buf_t *buf, unsigned flag, const char *tag, long lno,
 int moss_logf(moss_buf_t *buf, unsigned flag, const char *tag, long lno,
 		const char *fmt, ...) __attribute__((format(printf, 5, 6)));
 
+/** Size for a formatted message log. */
+#ifndef MOSS_LOG_LINE_MAX
+#define MOSS_LOG_LINE_MAX 256
+#endif
+
+/** Max size to expand for a long message log. */
+#ifndef MOSS_LOG_LINE_EXPAND_MAX
+#define MOSS_LOG_LINE_EXPAND_MAX (64 * 1024)
+#endif
+
+/** Slots for per tag severity override. */
+#ifndef MOSS_LOG_LEVEL_TAG_MAX
+#define MOSS_LOG_LEVEL_TAG_MAX 64
+#endif
+
 /** The max severity to output. */
 extern int moss_log_level_max;
 
+/** The max severity among per tag override. */
+extern int moss_log_level_tag_max;
+
+/** Build time max severity, message log above compiles to nothing. */
+#ifndef MOSS_LOG_LEVEL_BUILD
+#define MOSS_LOG_LEVEL_BUILD moss_log_level_verbose
+#endif
+
+/** Set per tag max severity.
+ *
+ * Override to more verbose than moss_log_level_max for the tag, ie. the
+ * function name.  Lookup is lock-free, the tag slot is never released.
+ *
+ * @param tag
+ * @param lvl Negative to remove the override.
+ * @return 0 when success, others when no more slot.
+ */
+int moss_log_level_tag_set(const char *tag, int lvl);
+
+/** Get per tag max severity.
+ *
+ * @param tag
+ * @return Negative when not override.
+ */
+int moss_log_level_tag_get(const char *tag);
+
+/** Check the severity to output before any formatting. */
+#define moss_log_enabled(_lvl, _tag) \
+	((int)((_lvl) & moss_log_level_mask) <= moss_log_level_max || \
+	((int)((_lvl) & moss_log_level_mask) <= moss_log_level_tag_max && \
+	(int)((_lvl) & moss_log_level_mask) <= moss_log_level_tag_get(_tag)))
+
+/** Check the severity against build time and runtime setting. */
+#define MOSS_LOG_ENABLED(_lvl, _tag) \
+	((int)((_lvl) & moss_log_level_mask) <= (int)MOSS_LOG_LEVEL_BUILD && \
+	moss_log_enabled(_lvl, _tag))
+
 /** Convert log enum to string. */
 #define moss_level_str(_lvl, _na) \
 	((_lvl) == moss_log_level_error ? "ERROR" : \
@@ -297,17 +850,314 @@ extern int moss_vlog(unsigned lvl, const char *tag, long lno,
 extern int moss_log(unsigned lvl, const char *tag, long lno,
 		const char *fmt, ...) __attribute__((format(printf, 4, 5)));
 
+/** Output preformatted message log, ie. structured record.
+ *
+ * @param data
+ * @param sz
+ * @return 0 when success, others when failure.
+ */
+extern int moss_log_write(const void *data, size_t sz);
+
+/** Wait for pending message log reach output.
+ *
+ * @return 0 when success, others when failure.
+ */
+extern int moss_log_flush(void);
+
+/** Output of message log.
+ *
+ * Platform output (ie. stdout) used when no sink set.
+ */
+typedef struct moss_log_sink_rec {
+	/** Output the lines, could called from multiple thread.
+	 *
+	 * Return 0 when success, others when failure.
+	 */
+	int (*write)(struct moss_log_sink_rec*, const moss_iov_t *iov, int cnt);
+
+	/** Wait for buffered lines reach output, optional.
+	 *
+	 * Return 0 when success, others when failure.
+	 */
+	int (*flush)(struct moss_log_sink_rec*);
+	void *priv;
+	int kv_enc; /**< moss_log_kv_enc_t for structured record. */
+} moss_log_sink_t;
+
+/** Set output of message log.
+ *
+ * The previous sink still may be used by other thread, flush and stop the
+ * other logging thread before release the previous sink.
+ *
+ * @param sink NULL for platform output.
+ * @return The previous sink.
+ */
+moss_log_sink_t *moss_log_sink_set(moss_log_sink_t *sink);
+
+/** Get output of message log.
+ *
+ * @return NULL when platform output.
+ */
+moss_log_sink_t *moss_log_sink_get(void);
+
+/** Sink keep message log in moss buffer, ie. for test.
+ *
+ * Drop the lines when moss buffer has insufficient space.
+ */
+typedef struct moss_log_sink_mem_rec {
+	moss_log_sink_t sink;
+	moss_buf_t *buf;
+	int lock;
+	unsigned long dropped;
+} moss_log_sink_mem_t;
+
+/** Initialize memory sink.
+ *
+ * @param mem
+ * @param buf
+ * @return The sink to moss_log_sink_set().
+ */
+moss_log_sink_t *moss_log_sink_mem_init(moss_log_sink_mem_t *mem,
+		moss_buf_t *buf);
+
+/** Slots for per call site rate limit. */
+#ifndef MOSS_LOG_RATELIMIT_SITE_MAX
+#define MOSS_LOG_RATELIMIT_SITE_MAX 256
+#endif
+
+/** Set per call site rate limit.
+ *
+ * Each call site, keyed by tag address and line number, pass burst messages
+ * then rate messages per second.  The suppressed count reported as "last
+ * message repeated" before the next message from the call site.  Not
+ * limit when the platform has no moss_ts1_get().
+ *
+ * @param burst 0 to disable.
+ * @param rate Messages per second.
+ * @return 0 when success, others when failure.
+ */
+int moss_log_ratelimit(unsigned burst, unsigned rate);
+
+/** Check the rate of call site, lock-free.
+ *
+ * @param tag
+ * @param lno
+ * @param rep Count suppressed before pass.
+ * @return 0 to output, others when suppressed.
+ */
+int moss_log_ratelimit_check(const char *tag, long lno, unsigned long *rep);
+
+/** Output the message when severity enabled, skip evaluate arguments. */
+#define MOSS_LOG(_lvl, ...) (MOSS_LOG_ENABLED(_lvl, __func__) ? \
+		moss_log(_lvl, __func__, __LINE__, __VA_ARGS__) : 0)
+
 /** Output the error severity message. */
-#define moss_error(...) moss_log(moss_log_level_error, __func__, __LINE__, __VA_ARGS__)
+#define moss_error(...) MOSS_LOG(moss_log_level_error, __VA_ARGS__)
 
 /** Output the debug severity message. */
-#define moss_debug(...) moss_log(moss_log_level_debug, __func__, __LINE__, __VA_ARGS__)
+#define moss_debug(...) MOSS_LOG(moss_log_level_debug, __VA_ARGS__)
 
 /** Output the information severity message. */
-#define moss_info(...) moss_log(moss_log_level_info, __func__, __LINE__, __VA_ARGS__)
+#define moss_info(...) MOSS_LOG(moss_log_level_info, __VA_ARGS__)
 
 /** Output the verbose severity message. */
-#define moss_verbose(...) moss_log(moss_log_level_verbose, __func__, __LINE__, __VA_ARGS__)
+#define moss_verbose(...) MOSS_LOG(moss_log_level_verbose, __VA_ARGS__)
+
+/** Max arguments for binary message log, call site with more rejected. */
+#define MOSS_BLOG_ARG_MAX 16
+
+/** Call site id remembered defined per stream, larger id defined with each
+ * record.
+ */
+#ifndef MOSS_BLOG_SITE_MAX
+#define MOSS_BLOG_SITE_MAX 1024
+#endif
+
+/** Call site of binary message log. */
+typedef struct moss_blog_site_rec {
+	const char *fmt, *tag;
+	long lno;
+	unsigned lvl;
+	unsigned id; /**< Assigned at the first use. */
+	int state; /**< 0 not parsed, 1 parsing, 2 parsed, 3 rejected. */
+	int argc;
+	unsigned char argt[MOSS_BLOG_ARG_MAX];
+} moss_blog_site_t;
+
+/** Stream of binary message log.
+ *
+ * Remember the call site defined to the moss buffer, each stream carry the
+ * definitions for its records.
+ */
+typedef struct moss_blog_rec {
+	moss_buf_t *buf;
+	uint32_t def[(MOSS_BLOG_SITE_MAX + 31) / 32]; /**< Bit set by site id. */
+} moss_blog_t;
+
+/** Initialize binary message log stream.
+ *
+ * Initialize again to define call site again at the next use, ie. the
+ * records taken by another decoder context or dropped.
+ *
+ * @param blog
+ * @param buf Receive the records.
+ */
+void moss_blog_init(moss_blog_t *blog, moss_buf_t *buf);
+
+/** Binary message log.
+ *
+ * Defer the formatting, append call site id, timestamp and raw arguments
+ * as record to moss buffer, moss_blog_decode() turns back to the text from
+ * moss_vlogf().  The first use of call site in the stream append the
+ * definition before.  Serialize the access to the stream, ie. stream per
+ * thread.
+ *
+ * Call site rejected when the format has conversion could not take back the
+ * same text (ie. %m, %ls, positional argument) or more than
+ * MOSS_BLOG_ARG_MAX arguments.  The call failed when the record larger than
+ * MOSS_LOG_LINE_MAX, string argument not truncated.
+ *
+ * Example:
+ * @code{.c}
+ * moss_blog_t blog;
+ *
+ * moss_blog_init(&blog, &blog_buf);
+ * moss_blog(&blog, moss_log_level_info, "rx %d bytes\n", len);
+ * @endcode
+ */
+#define moss_blog(_blog, _lvl, _fmt, _args...) do { \
+	static moss_blog_site_t _moss_blog_site = { \
+		.fmt = _fmt, .tag = __func__, .lno = __LINE__, .lvl = _lvl, \
+	}; \
+	(void)sizeof(printf(_fmt, ##_args)); \
+	if (MOSS_LOG_ENABLED(_lvl, __func__)) { \
+		moss_blogf(_blog, &_moss_blog_site, ##_args); \
+	} \
+} while(0)
+
+/** Append binary message log record.
+ *
+ * Reference to moss_blog().
+ *
+ * The definition sent again at the next call when failed to append.
+ *
+ * @param blog
+ * @param site
+ * @return 0 when success, others when failure.
+ */
+int moss_blogf(moss_blog_t *blog, moss_blog_site_t *site, ...);
+
+/** Decoder context for binary message log.
+ *
+ * Keep the call site definitions, use the same context for all records from
+ * the same process.
+ */
+typedef struct moss_blog_decoder_rec {
+	struct moss_blog_decoder_site_rec {
+		unsigned lvl;
+		long lno;
+		char *tag, *fmt;
+	} *site;
+	unsigned site_cnt;
+} moss_blog_decoder_t;
+
+/** Decode binary message log to text.
+ *
+ * @param dec Zero initialized at the first use.
+ * @param buf Records from moss_blog().
+ * @param txt Receive the text.
+ * @return Count of records decoded, stop when insufficient space for text,
+ *   -1 for malformed record.
+ */
+int moss_blog_decode(moss_blog_decoder_t *dec, moss_buf_t *buf,
+		moss_buf_t *txt);
+
+/** Release decoder context. */
+void moss_blog_decoder_free(moss_blog_decoder_t *dec);
+
+/** Value type of structured record. */
+typedef enum moss_log_kv_type_enum {
+	moss_log_kv_type_int = 1,
+	moss_log_kv_type_dbl,
+	moss_log_kv_type_str,
+} moss_log_kv_type_t;
+
+/** Typed key value pair of structured record. */
+typedef struct moss_log_kv_rec {
+	const char *key;
+	int type; /**< moss_log_kv_type_t */
+	union {
+		long long i;
+		double d;
+		const char *s;
+	} v;
+} moss_log_kv_t;
+
+#define MOSS_KV_INT(_k, _v) ((moss_log_kv_t){.key = _k, \
+		.type = moss_log_kv_type_int, .v.i = (_v)})
+#define MOSS_KV_DBL(_k, _v) ((moss_log_kv_t){.key = _k, \
+		.type = moss_log_kv_type_dbl, .v.d = (_v)})
+#define MOSS_KV_STR(_k, _v) ((moss_log_kv_t){.key = _k, \
+		.type = moss_log_kv_type_str, .v.s = (_v)})
+
+/** Encoding of structured record. */
+typedef enum moss_log_kv_enc_enum {
+	/** Line of key=value, quote the string value when necessary. */
+	moss_log_kv_enc_logfmt = 0,
+	/** Binary record, 32 bits length of the following fields, each field is
+	 * type (8 bits), key length (8 bits), key, value.  Integer and double
+	 * value in 64 bits, string value in 32 bits length and the string, host
+	 * byte order. */
+	moss_log_kv_enc_tlv,
+} moss_log_kv_enc_t;
+
+/** Encode structured record.
+ *
+ * Header fields lvl, ts, tag, lno typed as other pairs.
+ *
+ * @param buf
+ * @param enc moss_log_kv_enc_t
+ * @param lvl
+ * @param tag
+ * @param lno
+ * @param ts From moss_log_ts().
+ * @param kv
+ * @param cnt
+ * @return 0 when success, others when insufficient space.
+ */
+int moss_log_kv_encode(moss_buf_t *buf, int enc, unsigned lvl,
+		const char *tag, long lno, unsigned long long ts,
+		const moss_log_kv_t *kv, int cnt);
+
+/** Decode binary structured record to logfmt line.
+ *
+ * @param rec Record from moss_log_kv_enc_tlv.
+ * @param sz
+ * @param txt
+ * @return Bytes of the record, -1 for malformed or insufficient space.
+ */
+int moss_log_kv_decode(const void *rec, size_t sz, moss_buf_t *txt);
+
+/** Output structured record.
+ *
+ * Encoded to moss_log_sink_t::kv_enc of the sink, logfmt when no sink.
+ *
+ * @return 0 when success, others when failure.
+ */
+int moss_log_kv(unsigned lvl, const char *tag, long lno,
+		const moss_log_kv_t *kv, int cnt);
+
+/** Output structured record when severity enabled.
+ *
+ * Example:
+ * @code{.c}
+ * moss_kv(moss_log_level_info, MOSS_KV_STR("ev", "rx"),
+ *         MOSS_KV_INT("len", len), MOSS_KV_DBL("rssi", rssi));
+ * @endcode
+ */
+#define moss_kv(_lvl, _kv...) (MOSS_LOG_ENABLED(_lvl, __func__) ? \
+		moss_log_kv(_lvl, __func__, __LINE__, (moss_log_kv_t[]){_kv}, \
+		sizeof((moss_log_kv_t[]){_kv}) / sizeof(moss_log_kv_t)) : 0)
 
 /** @} MOSS_LOG */
 
@@ -336,6 +1186,12 @@ extern int moss_file_size(const char *path);
 /* 4 float vector type */
 typedef float v4sf_t __attribute__((vector_size(sizeof(float) * 4)));
 
+/* 8 float vector type */
+typedef float v8sf_t __attribute__((vector_size(sizeof(float) * 8)));
+
+/* 16 float vector type */
+typedef float v16sf_t __attribute__((vector_size(sizeof(float) * 16)));
+
 void moss_matrix_mul_v4sf(int am, int an, float *a, int bn, float *b, float *c);
 #endif
 
@@ -362,8 +1218,156 @@ void moss_matrix_mul_v4sf(int am, int an, float *a, int bn, float *b, float *c);
  * @param c The matrix **c** (output)
  */
 void moss_matrix_mul_sw(int am, int an, float *a, int bn, float *b, float *c);
+
+/** Matrix multiply, cache blocked and vectorized.
+ *
+ * Pack panels of **a** and **b** and compute tile of **c** in vector
+ * register, kernel selected for the cpu at the first call (SSE2/NEON,
+ * AVX2 or AVX-512).  Each element of **c** accumulated in the order of
+ * **an**, the result is the same to moss_matrix_mul_sw() when no fused
+ * multiply-add.  Fallback to moss_matrix_mul_sw() without GCC vector
+ * extension.
+ *
+ * Reference to moss_matrix_mul_sw() for the parameters.
+ */
 void moss_matrix_mul(int am, int an, float *a, int bn, float *b, float *c);
 
+/** Matrix multiply on sub-matrix.
+ *
+ * Same to moss_matrix_mul() but the rows of the matrix separated by the
+ * leading dimension, ie. lda for the matrix **a**.  Element of **c** only
+ * depend on the row of **a** and the column of **b**, result the same no
+ * matter how **c** split to sub-matrix.
+ *
+ * @param am
+ * @param an
+ * @param a
+ * @param lda Distance between row of the matrix **a**, >= an.
+ * @param bn
+ * @param b
+ * @param ldb Distance between row of the matrix **b**, >= bn.
+ * @param c
+ * @param ldc Distance between row of the matrix **c**, >= bn.
+ */
+void moss_matrix_mul_ld(int am, int an, const float *a, int lda, int bn,
+		const float *b, int ldb, float *c, int ldc);
+
+/** General matrix multiply.
+ *
+ * c = alpha * op(a) * op(b) + beta * c, op(a) is m \* k and op(b) is
+ * k \* n, row major with leading dimension for sub-matrix.  Transpose flag
+ * read the matrix as column major, ie. element (i, k) of op(a) at
+ * a[k * lda + i] when ta set.  beta scale **c** before accumulate, **c** not
+ * read when beta is 0.  Go moss_sgemv() when n is 1.
+ *
+ * @param ta Transpose **a**.
+ * @param tb Transpose **b**.
+ * @param m
+ * @param n
+ * @param k
+ * @param alpha
+ * @param a
+ * @param lda
+ * @param b
+ * @param ldb
+ * @param beta
+ * @param c
+ * @param ldc
+ */
+void moss_sgemm(int ta, int tb, int m, int n, int k, float alpha,
+		const float *a, int lda, const float *b, int ldb, float beta,
+		float *c, int ldc);
+
+/** General matrix vector multiply.
+ *
+ * y = alpha * op(a) * x + beta * y, **a** is m \* n row major.  Dot product
+ * of row in vector when not transpose, otherwise accumulate the row scaled
+ * by x.  **y** not read when beta is 0.
+ *
+ * @param ta Transpose **a**, y has n element, otherwise m.
+ * @param m
+ * @param n
+ * @param alpha
+ * @param a
+ * @param lda
+ * @param x
+ * @param incx Distance between element of **x**.
+ * @param beta
+ * @param y
+ * @param incy Distance between element of **y**.
+ */
+void moss_sgemv(int ta, int m, int n, float alpha, const float *a, int lda,
+		const float *x, int incx, float beta, float *y, int incy);
+
+/** Batched small matrix multiply in structure of arrays.
+ *
+ * Compute cnt products of c = a * b, the same element of all matrix
+ * contiguous, ie. element (m, n) of the matrix p of **a** at
+ * a[(m * an + n) * ld + p].  Kernel fully unrolled for 3 \* 3 and 4 \* 4,
+ * vector lanes compute 4, 8 or 16 products at once.
+ *
+ * @param am
+ * @param an
+ * @param bn
+ * @param cnt Count of products.
+ * @param a
+ * @param b
+ * @param c
+ * @param ld Distance between element of the matrix, >= cnt.
+ */
+void moss_matrix_mul_batch(int am, int an, int bn, int cnt, const float *a,
+		const float *b, float *c, int ld);
+
+/** Flag for fixed-point matrix multiply. */
+typedef enum moss_q_flag_enum {
+	/** Round to nearest (half up), otherwise truncate toward negative. */
+	moss_q_flag_round = (1 << 0),
+} moss_q_flag_t;
+
+/** Fixed-point Q15 matrix multiply, reference implementation.
+ *
+ * Product in Q30 accumulated in 64 bits, shift back to Q15 with the
+ * rounding in flag and saturate.
+ *
+ * Reference to moss_matrix_mul_sw() for the matrix parameters.
+ *
+ * @param flag moss_q_flag_t
+ */
+void moss_matrix_mul_q15_sw(int am, int an, const int16_t *a, int bn,
+		const int16_t *b, int16_t *c, unsigned flag);
+
+/** Fixed-point Q15 matrix multiply.
+ *
+ * Vectorized across columns of **b** when GCC vector extension, bit exact
+ * to moss_matrix_mul_q15_sw().
+ */
+void moss_matrix_mul_q15(int am, int an, const int16_t *a, int bn,
+		const int16_t *b, int16_t *c, unsigned flag);
+
+/** Fixed-point Q31 matrix multiply.
+ *
+ * Product in Q62 accumulated in 64 bits with saturation, shift back to Q31
+ * with the rounding in flag and saturate.
+ *
+ * Reference to moss_matrix_mul_sw() for the matrix parameters.
+ *
+ * @param flag moss_q_flag_t
+ */
+void moss_matrix_mul_q31(int am, int an, const int32_t *a, int bn,
+		const int32_t *b, int32_t *c, unsigned flag);
+
+/** Convert float to Q15, round to nearest and saturate. */
+void moss_q15_from_float(int16_t *q, const float *f, size_t cnt);
+
+/** Convert Q15 to float. */
+void moss_q15_to_float(float *f, const int16_t *q, size_t cnt);
+
+/** Convert float to Q31, round to nearest and saturate. */
+void moss_q31_from_float(int32_t *q, const float *f, size_t cnt);
+
+/** Convert Q31 to float. */
+void moss_q31_to_float(float *f, const int32_t *q, size_t cnt);
+
 /** Get timestamp in type unsigned long. */
 extern unsigned long moss_ts1_get(unsigned long *ts0);
 
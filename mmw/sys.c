@@ -2,19 +2,75 @@
 
 const char *moss_newline = "\n";
 
-static char _log_buf[256];
-static moss_buf_t log_buf = {.data = _log_buf, .cap = sizeof(_log_buf)};
+/* Single thread target format message log on static memory. */
+static char log_mem[MOSS_LOG_LINE_MAX];
 
-int moss_vlog(unsigned lvl, const char *tag, long lno,
+static int log_vlog(unsigned lvl, const char *tag, long lno,
 		const char *fmt, va_list va) {
+	moss_buf_t buf = {.data = log_mem, .cap = sizeof(log_mem)};
+	moss_log_sink_t *sink;
 	int r;
 
-	log_buf.pos = log_buf.lmt = 0;
-	r = moss_vlogf(&log_buf, lvl, tag, lno, fmt, va);
-	printf("%s", (char*)log_buf.data);
+	r = moss_vlogf_expand(&buf, MOSS_LOG_LINE_EXPAND_MAX, lvl, tag, lno,
+			fmt, va);
+	if (buf.lmt <= 0) {
+		;
+	} else if ((sink = moss_log_sink_get())) {
+		moss_iov_t iov = {.iov_base = buf.data, .iov_len = buf.lmt};
+
+		(*sink->write)(sink, &iov, 1);
+	} else {
+		fwrite(buf.data, 1, buf.lmt, stdout);
+	}
+	if (buf.data != log_mem) free(buf.data);
 	return r;
 }
 
+int moss_log_flush(void) {
+	moss_log_sink_t *sink = moss_log_sink_get();
+
+	if (!sink) return fflush(stdout);
+	return sink->flush ? (*sink->flush)(sink) : 0;
+}
+
+int moss_log_write(const void *data, size_t sz) {
+	moss_log_sink_t *sink;
+
+	if (sz <= 0) return 0;
+	if ((sink = moss_log_sink_get())) {
+		moss_iov_t iov = {.iov_base = (void*)data, .iov_len = sz};
+
+		return (*sink->write)(sink, &iov, 1);
+	}
+	return fwrite(data, 1, sz, stdout) == sz ? 0 : -1;
+}
+
+static int log_printf(unsigned lvl, const char *tag, long lno,
+		const char *fmt, ...) {
+	va_list va;
+	int r;
+
+	va_start(va, fmt);
+	r = log_vlog(lvl, tag, lno, fmt, va);
+	va_end(va);
+	return r;
+}
+
+int moss_vlog(unsigned lvl, const char *tag, long lno,
+		const char *fmt, va_list va) {
+	unsigned long rep;
+
+	if (!moss_log_enabled(lvl, tag)
+			|| moss_log_ratelimit_check(tag, lno, &rep) != 0) {
+		return 0;
+	}
+	if (rep > 0) {
+		log_printf(lvl, tag, lno, "last message repeated %lu times%s", rep,
+				moss_newline);
+	}
+	return log_vlog(lvl, tag, lno, fmt, va);
+}
+
 int moss_log(unsigned lvl, const char *tag, long lno,
 		const char *fmt, ...) {
 	va_list va;
@@ -38,6 +94,16 @@ int moss_logt(moss_buf_t *buf, unsigned flag, const char *tag, long lno) {
 	return -1;
 }
 
+unsigned long long moss_log_ts(void) {
+	return 0;
+}
+
+int moss_log_ts_str(moss_buf_t *buf, unsigned long long ts) {
+	(void)buf;
+	(void)ts;
+	return -1;
+}
+
 int moss_file_size(const char *path) {
 //	struct stat st;
 //	int r;
@@ -7,6 +7,59 @@ static unsigned long alt_memcpy(moss_memcpy_t func, void *tgt, const void *src,
 	return 0;
 }
 
+/* Copy to ring memory at pos, split at the end of ring memory. */
+static void buf_copy_in(moss_memcpy_t func, void *ring, size_t cap, size_t pos,
+		const void *data, size_t sz) {
+	size_t data_sz = MOSS_MIN(sz, cap - pos);
+
+	alt_memcpy(func, (char*)ring + pos, data, data_sz);
+	if (sz > data_sz) {
+		alt_memcpy(func, ring, (char*)data + data_sz, sz - data_sz);
+	}
+}
+
+/* Copy from ring memory at pos, split at the end of ring memory. */
+static void buf_copy_out(moss_memcpy_t func, void *ring, size_t cap, size_t pos,
+		void *data, size_t sz) {
+	size_t data_sz = MOSS_MIN(sz, cap - pos);
+
+	alt_memcpy(func, data, (char*)ring + pos, data_sz);
+	if (sz > data_sz) {
+		alt_memcpy(func, (char*)data + data_sz, ring, sz - data_sz);
+	}
+}
+
+#if MOSS_BUF_STATS
+static void buf_stats_xfer(moss_buf_stats_t *stats, size_t lmt, int wr,
+		size_t sz, size_t left) {
+	int hist = 0;
+
+	if (sz > 0) {
+		hist = sizeof(unsigned long long) * 8 - 1 - __builtin_clzll(sz);
+		if (hist >= MOSS_BUF_STATS_HIST) hist = MOSS_BUF_STATS_HIST - 1;
+		__atomic_fetch_add(&stats->hist[hist], 1, __ATOMIC_RELAXED);
+		__atomic_fetch_add(wr ? &stats->wr : &stats->rd, sz,
+				__ATOMIC_RELAXED);
+	}
+	if (left > 0) __atomic_fetch_add(&stats->short_wr, 1, __ATOMIC_RELAXED);
+	if (wr && lmt > __atomic_load_n(&stats->hiwat, __ATOMIC_RELAXED)) {
+		__atomic_store_n(&stats->hiwat, lmt, __ATOMIC_RELAXED);
+	}
+}
+
+#  define buf_stats_wr(_buf, _sz, _left) do { \
+	if ((_buf)->stats) buf_stats_xfer((_buf)->stats, (_buf)->lmt, 1, \
+			_sz, _left); \
+} while(0)
+#  define buf_stats_rd(_buf, _sz) do { \
+	if ((_buf)->stats) buf_stats_xfer((_buf)->stats, (_buf)->lmt, 0, \
+			_sz, 0); \
+} while(0)
+#else
+#  define buf_stats_wr(_buf, _sz, _left) do { } while(0)
+#  define buf_stats_rd(_buf, _sz) do { } while(0)
+#endif
+
 static int moss_rb_cmp(moss_rb_entry_t *a, moss_rb_entry_t *b)
 {
 	if (a->cmp) return (a->cmp)(a, b);
@@ -26,72 +79,417 @@ size_t moss_stripl(const void **buf, size_t sz, const char *ext) {
 	return sz;
 }
 
-int moss_buf_write(moss_buf_t *buf, const void *data, size_t sz) {
-	int sz_max = MOSS_MIN(sz, (buf->cap - buf->lmt));
-	if (!data || sz_max <= 0) return 0;
-	char *data_pos = (char*)buf->data + buf->pos + buf->lmt;
-	if (data_pos >= (char*)buf->data + buf->cap) data_pos -= buf->cap;
-	int data_sz = MOSS_MIN(sz_max, (char*)buf->data + buf->cap - data_pos);
-	alt_memcpy(buf->memcpy, data_pos, data, data_sz);
-	if (sz_max > data_sz) {
-		alt_memcpy(buf->memcpy, buf->data, (char*)data + data_sz,
-				sz_max - data_sz);
+#define buf_cap_pow2(_cap) (((_cap) & ((_cap) - 1)) == 0)
+
+static size_t buf_pow2_ceil(size_t cap) {
+	size_t cap2;
+
+	for (cap2 = 1; cap2 < cap; cap2 <<= 1);
+	return cap2;
+}
+
+/* Wrap offset in [0, 2 * cap) to ring memory, moss_buf_flag_pow2 only set
+ * on power of 2 capable.
+ */
+#if MOSS_BUF_POW2
+#  define buf_wrap(_buf, _pos) ((_pos) & ((_buf)->cap - 1))
+#else
+#  define buf_wrap(_buf, _pos) (((_buf)->flag & moss_buf_flag_pow2) ? \
+		((_pos) & ((_buf)->cap - 1)) : \
+		((_pos) >= (_buf)->cap ? (_pos) - (_buf)->cap : (_pos)))
+#endif
+
+#if MOSS_BUF_STATS
+int moss_buf_stats_get(moss_buf_t *buf, moss_buf_stats_t *stats) {
+	int i;
+
+	if (!buf->stats) return -1;
+	stats->wr = __atomic_load_n(&buf->stats->wr, __ATOMIC_RELAXED);
+	stats->rd = __atomic_load_n(&buf->stats->rd, __ATOMIC_RELAXED);
+	stats->hiwat = __atomic_load_n(&buf->stats->hiwat, __ATOMIC_RELAXED);
+	stats->short_wr = __atomic_load_n(&buf->stats->short_wr,
+			__ATOMIC_RELAXED);
+	for (i = 0; i < MOSS_BUF_STATS_HIST; i++) {
+		stats->hist[i] = __atomic_load_n(&buf->stats->hist[i],
+				__ATOMIC_RELAXED);
+	}
+	return 0;
+}
+
+void moss_buf_stats_reset(moss_buf_t *buf) {
+	int i;
+
+	if (!buf->stats) return;
+	__atomic_store_n(&buf->stats->wr, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&buf->stats->rd, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&buf->stats->hiwat, buf->lmt, __ATOMIC_RELAXED);
+	__atomic_store_n(&buf->stats->short_wr, 0, __ATOMIC_RELAXED);
+	for (i = 0; i < MOSS_BUF_STATS_HIST; i++) {
+		__atomic_store_n(&buf->stats->hist[i], 0, __ATOMIC_RELAXED);
+	}
+}
+#endif
+
+int moss_buf_init(moss_buf_t *buf, void *data, size_t cap, unsigned flag) {
+	if ((MOSS_BUF_POW2 || (flag & moss_buf_flag_pow2)) && !buf_cap_pow2(cap)) {
+		moss_error("Capable not power of 2: %zu\n", cap);
+		return -1;
+	}
+	memset(buf, 0, sizeof(*buf));
+	buf->data = data;
+	buf->cap = cap;
+	buf->flag = flag;
+	if (buf_cap_pow2(cap)) buf->flag |= moss_buf_flag_pow2;
+	return 0;
+}
+
+size_t moss_buf_write(moss_buf_t *buf, const void *data, size_t sz) {
+	size_t sz_max = MOSS_MIN(sz, (buf->cap - buf->lmt));
+
+	if (!data || sz_max <= 0) {
+		if (data && sz > 0) buf_stats_wr(buf, 0, sz);
+		return 0;
+	}
+	if (buf->flag & moss_buf_flag_mirror) {
+		alt_memcpy(buf->memcpy, (char*)buf->data + buf->pos + buf->lmt,
+				data, sz_max);
+	} else {
+		buf_copy_in(buf->memcpy, buf->data, buf->cap,
+				buf_wrap(buf, buf->pos + buf->lmt), data, sz_max);
 	}
 	buf->lmt += sz_max;
+	buf_stats_wr(buf, sz_max, sz - sz_max);
 	return sz - sz_max;
 }
 
-int moss_buf_read(moss_buf_t *buf, void *data, size_t sz) {
-	size_t _sz = sz = MOSS_MIN(sz, buf->lmt);
-	while (sz > 0) {
-		char *data_pos = (char*)buf->data + buf->pos;
-		int data_sz = buf->cap - buf->pos;
-		if (data_sz > sz) data_sz = sz;
-		alt_memcpy(buf->memcpy, data, data_pos, data_sz);
-		if ((buf->pos += data_sz) >= buf->cap)
-			buf->pos -= buf->cap;
-		buf->lmt -= data_sz;
-		sz -= data_sz;
-		data = (char*)data + data_sz;
+size_t moss_buf_read(moss_buf_t *buf, void *data, size_t sz) {
+	if ((sz = MOSS_MIN(sz, buf->lmt)) <= 0) return 0;
+	if (buf->flag & moss_buf_flag_mirror) {
+		alt_memcpy(buf->memcpy, data, (char*)buf->data + buf->pos, sz);
+	} else {
+		buf_copy_out(buf->memcpy, buf->data, buf->cap, buf->pos, data, sz);
 	}
-	return _sz;
+	return moss_buf_consume(buf, sz);
 }
 
-int moss_buf_expand(moss_buf_t *buf, size_t cap, int retain) {
-	void *data;
+/* Segments for sz bytes from pos, split at the end of ring memory. */
+static int buf_iov(void *ring, size_t cap, size_t pos, size_t sz,
+		moss_iov_t *iov) {
+	if (sz <= 0) return 0;
+	iov[0].iov_base = (char*)ring + pos;
+	if ((iov[0].iov_len = MOSS_MIN(sz, cap - pos)) >= sz) return 1;
+	iov[1].iov_base = ring;
+	iov[1].iov_len = sz - iov[0].iov_len;
+	return 2;
+}
 
-	if (cap <= 0 || buf->cap >= cap) return 0;
-	cap = (cap + 0x3fff) & ~0x3fff;
-	if (!(data = malloc(cap))) {
+/* Mirrored ring memory seems double sized. */
+#define buf_ring_cap(_buf) (((_buf)->flag & moss_buf_flag_mirror) ? \
+		(_buf)->cap + (_buf)->cap : (_buf)->cap)
+
+int moss_buf_reserve(moss_buf_t *buf, size_t sz, moss_iov_t *iov) {
+	size_t pos = buf->pos + buf->lmt;
+
+	if (!(buf->flag & moss_buf_flag_mirror)) pos = buf_wrap(buf, pos);
+	return buf_iov(buf->data, buf_ring_cap(buf), pos,
+			MOSS_MIN(sz, buf->cap - buf->lmt), iov);
+}
+
+size_t moss_buf_commit(moss_buf_t *buf, size_t sz) {
+	if (sz > buf->cap - buf->lmt) sz = buf->cap - buf->lmt;
+	buf->lmt += sz;
+	buf_stats_wr(buf, sz, 0);
+	return sz;
+}
+
+int moss_buf_peek(moss_buf_t *buf, moss_iov_t *iov) {
+	return buf_iov(buf->data, buf_ring_cap(buf), buf->pos, buf->lmt, iov);
+}
+
+size_t moss_buf_consume(moss_buf_t *buf, size_t sz) {
+	if (sz > buf->lmt) sz = buf->lmt;
+	buf->pos = buf_wrap(buf, buf->pos + sz);
+	buf->lmt -= sz;
+	buf_stats_rd(buf, sz);
+	return sz;
+}
+
+#if MOSS_BUF_POW2
+/* Free-running spsc index, unsigned overflow agree with power of 2 cap. */
+#  define spsc_lmt(_head, _tail, _cap) ((size_t)((_head) - (_tail)))
+#  define spsc_add(_idx, _sz, _cap) ((_idx) + (_sz))
+#  define spsc_pos(_idx, _cap) ((_idx) & ((_cap) - 1))
+#else
+/* Valid data between spsc index, both index in [0, 2 * cap). */
+static size_t spsc_lmt(size_t head, size_t tail, size_t cap) {
+	return head >= tail ? head - tail : head + cap + cap - tail;
+}
+
+/* Advance spsc index and wrap in [0, 2 * cap). */
+static size_t spsc_add(size_t idx, size_t sz, size_t cap) {
+	if ((idx += sz) >= cap + cap) idx -= cap + cap;
+	return idx;
+}
+
+/* Offset to ring memory for spsc index. */
+#  define spsc_pos(_idx, _cap) ((_idx) >= (_cap) ? (_idx) - (_cap) : (_idx))
+#endif
+
+size_t moss_buf_spsc_write(moss_buf_spsc_t *buf, const void *data, size_t sz) {
+	size_t head, sz_max;
+
+	if (!data || sz <= 0) return 0;
+	head = __atomic_load_n(&buf->head, __ATOMIC_RELAXED);
+	if ((sz_max = buf->cap - spsc_lmt(head, buf->tail_cache, buf->cap)) < sz) {
+		// refresh the cached tail only when seems insufficient
+		buf->tail_cache = __atomic_load_n(&buf->tail, __ATOMIC_ACQUIRE);
+		sz_max = buf->cap - spsc_lmt(head, buf->tail_cache, buf->cap);
+	}
+	if (sz_max > sz) sz_max = sz;
+	if (sz_max <= 0) return sz;
+	buf_copy_in(buf->memcpy, buf->data, buf->cap, spsc_pos(head, buf->cap),
+			data, sz_max);
+	__atomic_store_n(&buf->head, spsc_add(head, sz_max, buf->cap),
+			__ATOMIC_RELEASE);
+	return sz - sz_max;
+}
+
+size_t moss_buf_spsc_read(moss_buf_spsc_t *buf, void *data, size_t sz) {
+	size_t tail, sz_max;
+
+	if (!data || sz <= 0) return 0;
+	tail = __atomic_load_n(&buf->tail, __ATOMIC_RELAXED);
+	if ((sz_max = spsc_lmt(buf->head_cache, tail, buf->cap)) < sz) {
+		buf->head_cache = __atomic_load_n(&buf->head, __ATOMIC_ACQUIRE);
+		sz_max = spsc_lmt(buf->head_cache, tail, buf->cap);
+	}
+	if (sz_max > sz) sz_max = sz;
+	if (sz_max <= 0) return 0;
+	buf_copy_out(buf->memcpy, buf->data, buf->cap, spsc_pos(tail, buf->cap),
+			data, sz_max);
+	__atomic_store_n(&buf->tail, spsc_add(tail, sz_max, buf->cap),
+			__ATOMIC_RELEASE);
+	return sz_max;
+}
+
+size_t moss_buf_spsc_lmt(moss_buf_spsc_t *buf) {
+	size_t tail = __atomic_load_n(&buf->tail, __ATOMIC_ACQUIRE);
+
+	return spsc_lmt(__atomic_load_n(&buf->head, __ATOMIC_ACQUIRE), tail,
+			buf->cap);
+}
+
+/* Prepare copy descriptors for sz bytes at ring offset pos. */
+static int buf_xfer_prep(moss_buf_t *buf, moss_buf_xfer_t *xfer, size_t pos,
+		void *data, size_t sz, int to_ring) {
+	moss_iov_t iov[2];
+	int i;
+
+	if (buf->flag & moss_buf_flag_mirror) {
+		xfer->cp_cnt = buf_iov(buf->data, buf->cap + buf->cap, pos, sz, iov);
+	} else {
+		xfer->cp_cnt = buf_iov(buf->data, buf->cap, buf_wrap(buf, pos), sz,
+				iov);
+	}
+	for (i = 0; i < xfer->cp_cnt; i++) {
+		moss_copy_t *cp = &xfer->cp[i];
+
+		cp->tgt = to_ring ? iov[i].iov_base : data;
+		cp->src = to_ring ? data : iov[i].iov_base;
+		cp->sz = iov[i].iov_len;
+		cp->done = 0;
+		data = (char*)data + iov[i].iov_len;
+	}
+	xfer->sz = sz;
+	return xfer->cp_cnt;
+}
+
+int moss_buf_write_submit(moss_buf_async_t *abuf, moss_buf_xfer_t *xfer,
+		const void *data, size_t sz) {
+	moss_buf_t *buf = abuf->buf;
+	size_t sz_max = MOSS_MIN(sz, buf->cap - buf->lmt - abuf->wpend);
+
+	if (!data || sz_max <= 0) return sz;
+	buf_xfer_prep(buf, xfer, buf->pos + buf->lmt + abuf->wpend, (void*)data,
+			sz_max, 1);
+	if ((*abuf->engine->submit)(abuf->engine, xfer->cp, xfer->cp_cnt) != 0) {
+		return -1;
+	}
+	abuf->wpend += sz_max;
+	TAILQ_INSERT_TAIL(&abuf->wq, &xfer->qent, entry);
+	return sz - sz_max;
+}
+
+int moss_buf_read_submit(moss_buf_async_t *abuf, moss_buf_xfer_t *xfer,
+		void *data, size_t sz) {
+	moss_buf_t *buf = abuf->buf;
+
+	if (!data || (sz = MOSS_MIN(sz, buf->lmt - abuf->rpend)) <= 0) return 0;
+	buf_xfer_prep(buf, xfer, buf->pos + abuf->rpend, data, sz, 0);
+	if ((*abuf->engine->submit)(abuf->engine, xfer->cp, xfer->cp_cnt) != 0) {
 		return -1;
 	}
-	if (buf->data) {
-		if (retain && buf->lmt > 0) {
-			moss_buf_read(buf, data, buf->lmt);
-			buf->pos = 0;
+	abuf->rpend += sz;
+	TAILQ_INSERT_TAIL(&abuf->rq, &xfer->qent, entry);
+	return sz;
+}
+
+/* Get completed transfer at the head of the queue. */
+static moss_buf_xfer_t *buf_xfer_done(moss_tailq_t *q) {
+	moss_tailq_entry_t *qent;
+	moss_buf_xfer_t *xfer;
+	int i;
+
+	if (!(qent = TAILQ_FIRST(q))) return NULL;
+	xfer = MOSS_CONTAINER_OF(qent, moss_buf_xfer_t, qent);
+	for (i = 0; i < xfer->cp_cnt; i++) {
+		if (!__atomic_load_n(&xfer->cp[i].done, __ATOMIC_ACQUIRE)) return NULL;
+	}
+	TAILQ_REMOVE(q, qent, entry);
+	return xfer;
+}
+
+int moss_buf_async_poll(moss_buf_async_t *abuf) {
+	moss_buf_xfer_t *xfer;
+	int cnt = 0;
+
+	while ((xfer = buf_xfer_done(&abuf->wq))) {
+		abuf->wpend -= xfer->sz;
+		abuf->buf->lmt += xfer->sz;
+		buf_stats_wr(abuf->buf, xfer->sz, 0);
+		cnt++;
+		if (xfer->cb) (*xfer->cb)(xfer);
+	}
+	while ((xfer = buf_xfer_done(&abuf->rq))) {
+		abuf->rpend -= xfer->sz;
+		moss_buf_consume(abuf->buf, xfer->sz);
+		cnt++;
+		if (xfer->cb) (*xfer->cb)(xfer);
+	}
+	return cnt;
+}
+
+/* Round up capable to allocation granularity. */
+static size_t buf_cap_round(moss_buf_t *buf, size_t cap) {
+	cap = (cap + 0x3fff) & ~0x3fff;
+	if (!MOSS_BUF_POW2 && !(buf->flag & moss_buf_flag_pow2)) return cap;
+	return buf_pow2_ceil(cap);
+}
+
+int moss_buf_expand(moss_buf_t *buf, size_t cap, int retain) {
+	size_t cap0 = buf->cap, head_sz, tail_sz;
+	char *data;
+
+	if (cap <= 0 || buf->cap >= cap) return 0;
+	if (buf->flag & moss_buf_flag_mirror) return -1;
+	// geometric growth amortize the copy
+	cap = buf_cap_round(buf, MOSS_MAX(cap, cap0 + cap0));
+	if (!retain || !buf->data) {
+		if (!(data = malloc(cap))) return -1;
+		if (buf->data) free(buf->data);
+		buf->pos = buf->lmt = 0;
+	} else {
+		// realloc could grow in place (or mremap for large block)
+		if (!(data = realloc(buf->data, cap))) return -1;
+		if (buf->pos + buf->lmt > cap0) {
+			// move the smaller segment across the old end of data memory
+			head_sz = buf->pos + buf->lmt - cap0;
+			tail_sz = cap0 - buf->pos;
+			if (head_sz <= tail_sz) {
+				memcpy(data + cap0, data, head_sz);
+			} else {
+				memmove(data + cap - tail_sz, data + buf->pos, tail_sz);
+				buf->pos = cap - tail_sz;
+			}
 		}
-		free(buf->data);
 	}
 	buf->data = data;
 	buf->cap = cap;
 	return 0;
 }
 
+int moss_buf_shrink(moss_buf_t *buf, size_t lowat) {
+	size_t cap, head_sz, tail_sz;
+	char *data;
+
+	if (buf->flag & moss_buf_flag_mirror) return -1;
+	// hysteresis to avoid shrink and expand again
+	if (!buf->data || buf->lmt > buf->cap / 4) return 0;
+	cap = buf_cap_round(buf, MOSS_MAX(lowat, buf->lmt + buf->lmt));
+	if (cap >= buf->cap) return 0;
+
+	// linearize valid data to the start of data memory
+	data = (char*)buf->data;
+	if (buf->pos + buf->lmt > buf->cap) {
+		head_sz = buf->pos + buf->lmt - buf->cap;
+		tail_sz = buf->cap - buf->pos;
+		memmove(data + tail_sz, data, head_sz);
+		memcpy(data, data + buf->pos, tail_sz);
+	} else if (buf->pos > 0) {
+		memmove(data, data + buf->pos, buf->lmt);
+	}
+	buf->pos = 0;
+	buf->cap = cap;
+	if ((data = realloc(buf->data, cap))) buf->data = data;
+	return 0;
+}
+
 int moss_buf_vprintf(moss_buf_t *buf, const char *fmt, va_list va) {
 	int r;
-	char ch, *ch_pos = NULL;
+	char ch, *ch_pos, *data = (char*)buf->data;
+	size_t pos = buf->pos + buf->lmt, sz, sz_max = buf->cap - buf->lmt;
+	va_list va2;
 
 	if (!fmt) return 0;
-	if (buf->pos + buf->lmt < buf->cap) {
-		ch = *(ch_pos = (char*)buf->data + buf->pos + buf->lmt);
+	if (sz_max <= 0) {
+		buf_stats_wr(buf, 0, 1);
+		return -1;
+	}
+	if ((buf->flag & moss_buf_flag_mirror) || pos >= buf->cap) {
+		// free space is contiguous
+		if (!(buf->flag & moss_buf_flag_mirror)) pos = buf_wrap(buf, pos);
+		sz = sz_max;
+	} else {
+		sz = buf->cap - pos;
+	}
+	ch = *(ch_pos = data + pos);
+	va_copy(va2, va);
+	r = vsnprintf(data + pos, sz, fmt, va2);
+	va_end(va2);
+	if (r >= 0 && (size_t)r < sz) {
+		buf->lmt += r;
+		buf_stats_wr(buf, r, 0);
+		return 0;
 	}
-	r = vsnprintf((char*)buf->data + buf->pos + buf->lmt,
-			buf->cap - buf->pos - buf->lmt, fmt, va);
-	if (buf->pos + buf->lmt + r >= buf->cap) {
-		if (ch_pos) *ch_pos = ch;
+	if (r < 0 || (size_t)r >= sz_max) {
+		*ch_pos = ch;
+		buf_stats_wr(buf, 0, 1);
 		return -1;
 	}
+
+	// free space split at the end of data memory, valid data stay in place
+	if ((size_t)r < buf->pos) {
+		// format to the front, then the leading part to the end
+		vsnprintf(data, buf->pos, fmt, va);
+		memcpy(data + pos, data, sz);
+		memmove(data, data + sz, r - sz);
+	} else {
+		// the front not hold the whole text, format aside then split
+		char mem[256], *txt = mem;
+
+		if ((size_t)r >= sizeof(mem) && !(txt = (char*)malloc(r + 1))) {
+			*ch_pos = ch;
+			buf_stats_wr(buf, 0, 1);
+			return -1;
+		}
+		vsnprintf(txt, r + 1, fmt, va);
+		memcpy(data + pos, txt, sz);
+		memcpy(data, txt + sz, r - sz);
+		if (txt != mem) free(txt);
+	}
+	data[r - sz] = '\0';
 	buf->lmt += r;
+	buf_stats_wr(buf, r, 0);
 	return 0;
 }
 
@@ -106,10 +504,239 @@ int moss_buf_printf(moss_buf_t *buf, const char *fmt, ...) {
 	return r;
 }
 
+/* Record length to mark the rest of data memory skipped. */
+#define BUF_MSG_SKIP ((uint32_t)-1)
+
+#define buf_msg_align(_sz) (((_sz) + MOSS_BUF_MSG_ALIGN - 1) & \
+		~(MOSS_BUF_MSG_ALIGN - 1))
+
+int moss_buf_msg_push(moss_buf_t *buf, const moss_iov_t *hdr,
+		const moss_iov_t *payload, int cnt) {
+	size_t pos, lmt, tail_sz, rec_sz;
+	uint32_t len;
+	char *rec;
+	int i;
+
+	// rewind for the most contiguous space
+	if (buf->lmt <= 0) buf->pos = 0;
+	for (i = 0, lmt = buf->lmt; i < cnt; i++) {
+		len = (hdr ? hdr[i].iov_len : 0) + (payload ? payload[i].iov_len : 0);
+		rec_sz = buf_msg_align(sizeof(len) + len);
+		if (rec_sz > buf->cap - lmt) break;
+		pos = buf->pos + lmt;
+		if (!(buf->flag & moss_buf_flag_mirror) && pos < buf->cap &&
+				rec_sz > (tail_sz = buf->cap - pos)) {
+			// skip to the start of data memory
+			if (rec_sz > buf->cap - lmt - tail_sz) break;
+			*(uint32_t*)((char*)buf->data + pos) = BUF_MSG_SKIP;
+			lmt += tail_sz;
+			pos = 0;
+		} else if (!(buf->flag & moss_buf_flag_mirror)) {
+			pos = buf_wrap(buf, pos);
+		}
+		rec = (char*)buf->data + pos;
+		*(uint32_t*)rec = len;
+		rec += sizeof(len);
+		if (hdr && hdr[i].iov_len > 0) {
+			alt_memcpy(buf->memcpy, rec, hdr[i].iov_base, hdr[i].iov_len);
+			rec += hdr[i].iov_len;
+		}
+		if (payload && payload[i].iov_len > 0) {
+			alt_memcpy(buf->memcpy, rec, payload[i].iov_base,
+					payload[i].iov_len);
+		}
+		lmt += rec_sz;
+	}
+	lmt -= buf->lmt;
+	buf->lmt += lmt;
+	buf_stats_wr(buf, lmt, cnt - i);
+	return i;
+}
+
+/* Get records from moss buffer, drop them when consume. */
+static int buf_msg_get(moss_buf_t *buf, moss_iov_t *msg, int cnt,
+		int consume) {
+	size_t pos = buf->pos, lmt = buf->lmt, room, rec_sz;
+	uint32_t len;
+	int i;
+
+	// length not trusted (ie. recovered from file), stop at the record not
+	// inside valid data
+#define buf_msg_room() ((buf->flag & moss_buf_flag_mirror) ? lmt : \
+		MOSS_MIN(lmt, buf->cap - pos))
+	for (i = 0; i < cnt && lmt > 0; ) {
+		if ((room = buf_msg_room()) < sizeof(len)) break;
+		len = *(uint32_t*)((char*)buf->data + pos);
+		if (len == BUF_MSG_SKIP) {
+			if (buf->cap - pos > lmt) break;
+			lmt -= buf->cap - pos;
+			pos = 0;
+			continue;
+		}
+		if ((rec_sz = buf_msg_align(sizeof(len) + len)) > room) break;
+		msg[i].iov_base = (char*)buf->data + pos + sizeof(len);
+		msg[i++].iov_len = len;
+		pos = buf_wrap(buf, pos + rec_sz);
+		lmt -= rec_sz;
+	}
+	// drop the trailing skip marker also
+	if (lmt > 0 && buf_msg_room() >= sizeof(len)
+			&& *(uint32_t*)((char*)buf->data + pos) == BUF_MSG_SKIP
+			&& buf->cap - pos <= lmt) {
+		lmt -= buf->cap - pos;
+		pos = 0;
+	}
+#undef buf_msg_room
+	if (consume) {
+		buf->pos = pos;
+		lmt = buf->lmt - lmt;
+		buf->lmt -= lmt;
+		buf_stats_rd(buf, lmt);
+	}
+	return i;
+}
+
+int moss_buf_msg_pop(moss_buf_t *buf, moss_iov_t *msg, int cnt) {
+	return buf_msg_get(buf, msg, cnt, 1);
+}
+
+int moss_buf_msg_peek(moss_buf_t *buf, moss_iov_t *msg, int cnt) {
+	return buf_msg_get(buf, msg, cnt, 0);
+}
+
+static void buf_seg_free(moss_buf_seg_t *seg) {
+	free(seg);
+}
+
+moss_buf_seg_t *moss_buf_seg_alloc(size_t cap) {
+	moss_buf_seg_t *seg;
+
+	if (MOSS_BUF_POW2) cap = buf_pow2_ceil(cap);
+	if (!(seg = (moss_buf_seg_t*)malloc(sizeof(*seg) + cap))) return NULL;
+	memset(seg, 0, sizeof(*seg));
+	moss_buf_init(&seg->buf, seg + 1, cap, 0);
+	seg->free = &buf_seg_free;
+	return seg;
+}
+
+void moss_buf_chain_add(moss_buf_chain_t *chain, moss_buf_seg_t *seg,
+		int head) {
+	if (head) {
+		TAILQ_INSERT_HEAD(&chain->segs, &seg->qent, entry);
+	} else {
+		TAILQ_INSERT_TAIL(&chain->segs, &seg->qent, entry);
+	}
+	chain->lmt += seg->buf.lmt;
+}
+
+#define buf_chain_seg(_qent) MOSS_CONTAINER_OF(_qent, moss_buf_seg_t, qent)
+
+int moss_buf_chain_append(moss_buf_chain_t *chain, const void *data,
+		size_t sz) {
+	moss_tailq_entry_t *qent;
+	moss_buf_seg_t *seg;
+	size_t data_sz;
+
+	if (!data || sz <= 0) return 0;
+	if ((qent = TAILQ_LAST(&chain->segs, moss_tailq_rec))) {
+		seg = buf_chain_seg(qent);
+		if ((data_sz = MOSS_MIN(sz, seg->buf.cap - seg->buf.lmt)) > 0) {
+			moss_buf_write(&seg->buf, data, data_sz);
+			chain->lmt += data_sz;
+			data = (char*)data + data_sz;
+			if ((sz -= data_sz) <= 0) return 0;
+		}
+	}
+	if (!(seg = moss_buf_seg_alloc(MOSS_MAX(sz, chain->seg_cap)))) return -1;
+	moss_buf_write(&seg->buf, data, sz);
+	moss_buf_chain_add(chain, seg, 0);
+	return 0;
+}
+
+int moss_buf_chain_prepend(moss_buf_chain_t *chain, const void *data,
+		size_t sz) {
+	moss_tailq_entry_t *qent;
+	moss_buf_seg_t *seg;
+	size_t data_sz;
+
+	if (!data || sz <= 0) return 0;
+	if ((qent = TAILQ_FIRST(&chain->segs))) {
+		// the trailing part right before the valid data of first segment
+		seg = buf_chain_seg(qent);
+		if ((data_sz = MOSS_MIN(sz, seg->buf.cap - seg->buf.lmt)) > 0) {
+			seg->buf.pos = buf_wrap(&seg->buf,
+					seg->buf.pos + seg->buf.cap - data_sz);
+			buf_copy_in(seg->buf.memcpy, seg->buf.data, seg->buf.cap,
+					seg->buf.pos, (char*)data + sz - data_sz, data_sz);
+			seg->buf.lmt += data_sz;
+			buf_stats_wr(&seg->buf, data_sz, 0);
+			chain->lmt += data_sz;
+			if ((sz -= data_sz) <= 0) return 0;
+		}
+	}
+	if (!(seg = moss_buf_seg_alloc(MOSS_MAX(sz, chain->seg_cap)))) return -1;
+	// leave free space at front for later prepend
+	seg->buf.pos = seg->buf.cap - sz;
+	moss_buf_write(&seg->buf, data, sz);
+	moss_buf_chain_add(chain, seg, 1);
+	return 0;
+}
+
+void moss_buf_chain_splice(moss_buf_chain_t *chain, moss_buf_chain_t *src) {
+	TAILQ_CONCAT(&chain->segs, &src->segs, entry);
+	chain->lmt += src->lmt;
+	src->lmt = 0;
+}
+
+/* Read or drop data from the start of moss buffer chain. */
+static size_t buf_chain_read(moss_buf_chain_t *chain, void *data, size_t sz) {
+	moss_tailq_entry_t *qent;
+	moss_buf_seg_t *seg;
+	size_t data_sz, _sz = sz;
+
+	while (sz > 0 && (qent = TAILQ_FIRST(&chain->segs))) {
+		seg = buf_chain_seg(qent);
+		if (data) {
+			data_sz = moss_buf_read(&seg->buf, data, sz);
+			data = (char*)data + data_sz;
+		} else {
+			data_sz = moss_buf_consume(&seg->buf, sz);
+		}
+		chain->lmt -= data_sz;
+		sz -= data_sz;
+		if (seg->buf.lmt <= 0) {
+			TAILQ_REMOVE(&chain->segs, qent, entry);
+			if (seg->free) (*seg->free)(seg);
+		}
+	}
+	return _sz - sz;
+}
+
+size_t moss_buf_chain_read(moss_buf_chain_t *chain, void *data, size_t sz) {
+	if (!data) return 0;
+	return buf_chain_read(chain, data, sz);
+}
+
+size_t moss_buf_chain_drain(moss_buf_chain_t *chain, size_t sz) {
+	return buf_chain_read(chain, NULL, sz);
+}
+
+void moss_buf_chain_free(moss_buf_chain_t *chain) {
+	moss_tailq_entry_t *qent;
+	moss_buf_seg_t *seg;
+
+	while ((qent = TAILQ_FIRST(&chain->segs))) {
+		TAILQ_REMOVE(&chain->segs, qent, entry);
+		seg = buf_chain_seg(qent);
+		if (seg->free) (*seg->free)(seg);
+	}
+	chain->lmt = 0;
+}
+
 int moss_vlogf(moss_buf_t *buf, unsigned flag, const char *tag, long lno,
 		const char *fmt, va_list va) {
 	char tm_str[32];
-	moss_buf_t tm_buf = {.data = tm_str, .cap = sizeof(tm_str) - 1};
+	moss_buf_t tm_buf = {.data = tm_str, .cap = sizeof(tm_str) / 2};
 
 	if (moss_logt(&tm_buf, flag, tag, lno) != 0) {
 		((char*)tm_buf.data)[tm_buf.lmt = 0] = '\0';
@@ -130,6 +757,27 @@ int moss_vlogf(moss_buf_t *buf, unsigned flag, const char *tag, long lno,
 	return 0;
 }
 
+int moss_vlogf_expand(moss_buf_t *buf, size_t cap_max, unsigned flag,
+		const char *tag, long lno, const char *fmt, va_list va) {
+	void *mem = buf->data, *data;
+	size_t cap;
+	va_list va2;
+	int r;
+
+	while (1) {
+		buf->pos = buf->lmt = 0;
+		va_copy(va2, va);
+		r = moss_vlogf(buf, flag, tag, lno, fmt, va2);
+		va_end(va2);
+		if (r == 0 || buf->cap >= cap_max) return r;
+		cap = MOSS_MIN(buf->cap * 4, cap_max);
+		if (!(data = malloc(cap))) return r;
+		if (buf->data != mem) free(buf->data);
+		buf->data = data;
+		buf->cap = cap;
+	}
+}
+
 int moss_logf(moss_buf_t *buf, unsigned flag, const char *tag, long lno,
 		const char *fmt, ...) {
 	va_list va;
@@ -141,57 +789,958 @@ int moss_logf(moss_buf_t *buf, unsigned flag, const char *tag, long lno,
 	return r;
 }
 
-int moss_readline(int (*getc)(void *arg), void *arg, char *_nl)
-{
-	int c, n;
-	char nl;
+/* Argument type for binary message log. */
+enum {
+	blog_arg_none,
+	blog_arg_int,
+	blog_arg_long,
+	blog_arg_llong,
+	blog_arg_size,
+	blog_arg_intmax,
+	blog_arg_ptrdiff,
+	blog_arg_double,
+	blog_arg_ldouble,
+	blog_arg_str,
+	blog_arg_ptr,
+	blog_arg_drop, /* %n */
+};
 
-	for (n = 0, nl = 0; (c = (*getc)(arg)) >= 0; n++) {
-		if (c == MOSS_LF) {
-			if (_nl) *_nl = nl + 1;
-			return n - nl;
+/* Mark definition record. */
+#define BLOG_DEF 0x80000000u
+
+/* Parse a conversion start from '%'.
+ *
+ * Return length of the conversion, argument types to argt for star width,
+ * star precision and the value.  argc 0 for "%%", -1 for the conversion
+ * could not take back the same text, ie. %m, %ls.
+ */
+static int blog_fmt_conv(const char *fmt, unsigned char *argt, int *argc) {
+	const char *conv = fmt + 1;
+	char mod = 0;
+
+	*argc = 0;
+	if (*conv == '%') return 2;
+	while (*conv && strchr("-+ #0'I", *conv)) conv++;
+	if (*conv == '*') {
+		argt[(*argc)++] = blog_arg_int;
+		conv++;
+	}
+	while (isdigit((unsigned char)*conv)) conv++;
+	if (*conv == '.') {
+		if (*++conv == '*') {
+			argt[(*argc)++] = blog_arg_int;
+			conv++;
 		}
-		nl = (c == MOSS_CR);
+		while (isdigit((unsigned char)*conv)) conv++;
 	}
-	if (_nl) *_nl = 0;
-	return (n <= 0) ? -1 : n;
+	switch (*conv) {
+	case 'h':
+		if (*++conv == 'h') conv++;
+		break;
+	case 'l':
+		mod = 'l';
+		if (*++conv == 'l') {
+			mod = 'q';
+			conv++;
+		}
+		break;
+	case 'q':
+		mod = 'q';
+		conv++;
+		break;
+	case 'L':
+	case 'j':
+	case 'z':
+	case 't':
+		mod = *conv++;
+		break;
+	}
+	switch (*conv) {
+	case 'c':
+		if (mod) break;
+		argt[(*argc)++] = blog_arg_int;
+		return conv + 1 - fmt;
+	case 'd':
+	case 'i':
+	case 'u':
+	case 'o':
+	case 'x':
+	case 'X':
+		if (mod == 'L') break;
+		argt[(*argc)++] = mod == 'l' ? blog_arg_long :
+				mod == 'q' ? blog_arg_llong :
+				mod == 'z' ? blog_arg_size :
+				mod == 'j' ? blog_arg_intmax :
+				mod == 't' ? blog_arg_ptrdiff : blog_arg_int;
+		return conv + 1 - fmt;
+	case 'e':
+	case 'E':
+	case 'f':
+	case 'F':
+	case 'g':
+	case 'G':
+	case 'a':
+	case 'A':
+		if (mod && mod != 'l' && mod != 'L') break;
+		argt[(*argc)++] = mod == 'L' ? blog_arg_ldouble : blog_arg_double;
+		return conv + 1 - fmt;
+	case 's':
+		if (mod) break;
+		argt[(*argc)++] = blog_arg_str;
+		return conv + 1 - fmt;
+	case 'p':
+		argt[(*argc)++] = blog_arg_ptr;
+		return conv + 1 - fmt;
+	case 'n':
+		argt[(*argc)++] = blog_arg_drop;
+		return conv + 1 - fmt;
+	case '\0':
+		*argc = -1;
+		return conv - fmt;
+	}
+	*argc = -1;
+	return conv + 1 - fmt;
 }
 
-int moss_log_level_max = moss_log_level_info;
+/* Parse argument types for call site.
+ *
+ * Reject more than MOSS_BLOG_ARG_MAX arguments and conversion could not
+ * take back the same text, the decoder parse the whole format and would go
+ * out of step with the record.
+ */
+static int blog_site_parse(const char *fmt, unsigned char *argt, int *argc) {
+	unsigned char conv_argt[3];
+	int conv_argc, i;
 
-#ifdef __GNUC__
-void moss_matrix_mul_v4sf(int am, int an, float *a, int bn, float *b,
-		float *c) {
-	int m, n;
+	*argc = 0;
+	while ((fmt = strchr(fmt, '%'))) {
+		fmt += blog_fmt_conv(fmt, conv_argt, &conv_argc);
+		if (conv_argc < 0 || *argc + conv_argc > MOSS_BLOG_ARG_MAX) {
+			return -1;
+		}
+		for (i = 0; i < conv_argc; i++) argt[(*argc)++] = conv_argt[i];
+	}
+	return 0;
+}
 
-	for (m = 0; m < am; m++) {
-		for (n = 0; n < bn; n++) {
-			v4sf_t va, vb, vc;
+/* Append to record memory, or set overflow. */
+#define blog_put(_rec, _rec_end, _v) if ((_rec) + sizeof(_v) <= (_rec_end)) { \
+	memcpy(_rec, &(_v), sizeof(_v)); \
+	(_rec) += sizeof(_v); \
+} else { \
+	overflow = 1; \
+}
 
-			switch(an) {
-			case 4:
-				va[3] = a[3]; vb[3] = b[n + bn + bn + bn];
-			case 3:
-				va[2] = a[2]; vb[2] = b[n + bn + bn];
-			case 2:
-				va[1] = a[1]; vb[1] = b[n + bn];
-			case 1:
-			default:
-				va[0] = a[0]; vb[0] = b[n];
-			}
+/* Call site defined in the stream. */
+#define blog_def_test(_blog, _id) ((_id) < MOSS_BLOG_SITE_MAX && \
+		((_blog)->def[(_id) / 32] & (1u << ((_id) % 32))))
 
-			vc = va * vb;
-			*c = vc[0];
+void moss_blog_init(moss_blog_t *blog, moss_buf_t *buf) {
+	memset(blog, 0, sizeof(*blog));
+	blog->buf = buf;
+}
 
-			switch(an) {
-			case 4:
-				*c += vc[3];
-			case 3:
-				*c += vc[2];
-			case 2:
-				*c += vc[1];
-			case 1:
-			default:
+int moss_blogf(moss_blog_t *blog, moss_blog_site_t *site, ...) {
+	static unsigned site_id = 0;
+	char rec[MOSS_LOG_LINE_MAX], *rec_pos = rec, *rec_end = rec + sizeof(rec);
+	unsigned char argt_mem[MOSS_BLOG_ARG_MAX];
+	const unsigned char *argt = site->argt;
+	moss_iov_t hdr, payload;
+	uint32_t id;
+	uint64_t ts;
+	int state, argc, overflow = 0, i;
+	va_list va;
+
+	if ((state = __atomic_load_n(&site->state, __ATOMIC_ACQUIRE)) == 2) {
+		argc = site->argc;
+	} else if (state == 3) {
+		return -1;
+	} else {
+		// parse aside, not wait for the other thread parsing the same
+		if (blog_site_parse(site->fmt, argt_mem, &argc) != 0) {
+			__atomic_store_n(&site->state, 3, __ATOMIC_RELEASE);
+			moss_error("Unsupported format for binary log: %s\n", site->fmt);
+			return -1;
+		}
+		argt = argt_mem;
+		state = 0;
+		if (__atomic_compare_exchange_n(&site->state, &state, 1, 0,
+				__ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+			memcpy(site->argt, argt_mem, argc);
+			site->argc = argc;
+			__atomic_store_n(&site->state, 2, __ATOMIC_RELEASE);
+		}
+	}
+	if (!(id = __atomic_load_n(&site->id, __ATOMIC_RELAXED))) {
+		uint32_t id_new = __atomic_add_fetch(&site_id, 1, __ATOMIC_RELAXED);
+
+		// the id from other thread when lost
+		if (__atomic_compare_exchange_n(&site->id, &id, id_new, 0,
+				__ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+			id = id_new;
+		}
+	}
+
+	if (!blog_def_test(blog, id)) {
+		int32_t lvl = site->lvl;
+		int64_t lno = site->lno;
+		uint32_t def_id = id | BLOG_DEF;
+
+		blog_put(rec_pos, rec_end, def_id);
+		blog_put(rec_pos, rec_end, lvl);
+		blog_put(rec_pos, rec_end, lno);
+		i = MOSS_MIN(strlen(site->tag) + 1, (size_t)(rec_end - rec_pos));
+		memcpy(rec_pos, site->tag, i);
+		rec_pos[i - 1] = '\0';
+		hdr.iov_base = rec;
+		hdr.iov_len = rec_pos + i - rec;
+		payload.iov_base = (void*)site->fmt;
+		payload.iov_len = strlen(site->fmt) + 1;
+		// define again at the next call when failed
+		if (moss_buf_msg_push(blog->buf, &hdr, &payload, 1) != 1) return -1;
+		if (id < MOSS_BLOG_SITE_MAX) blog->def[id / 32] |= 1u << (id % 32);
+		rec_pos = rec;
+	}
+
+	ts = moss_log_ts();
+	blog_put(rec_pos, rec_end, id);
+	blog_put(rec_pos, rec_end, ts);
+	va_start(va, site);
+	for (i = 0; i < argc; i++) {
+		switch (argt[i]) {
+		case blog_arg_int: {
+			int32_t v = va_arg(va, int);
+			blog_put(rec_pos, rec_end, v);
+			break;
+		}
+		case blog_arg_long:
+		case blog_arg_llong:
+		case blog_arg_size:
+		case blog_arg_intmax:
+		case blog_arg_ptrdiff:
+		case blog_arg_ptr: {
+			int64_t v = argt[i] == blog_arg_long ? va_arg(va, long) :
+					argt[i] == blog_arg_llong ? va_arg(va, long long) :
+					argt[i] == blog_arg_size ? (int64_t)va_arg(va, size_t) :
+					argt[i] == blog_arg_intmax ? va_arg(va, intmax_t) :
+					argt[i] == blog_arg_ptrdiff ? va_arg(va, ptrdiff_t) :
+					(int64_t)(intptr_t)va_arg(va, void*);
+			blog_put(rec_pos, rec_end, v);
+			break;
+		}
+		case blog_arg_double: {
+			double v = va_arg(va, double);
+			blog_put(rec_pos, rec_end, v);
+			break;
+		}
+		case blog_arg_ldouble: {
+			long double v = va_arg(va, long double);
+			blog_put(rec_pos, rec_end, v);
+			break;
+		}
+		case blog_arg_str: {
+			const char *v = va_arg(va, const char*);
+			uint32_t len = v ? strlen(v) : (uint32_t)-1;
+
+			// whole string or fail, keep the text same as moss_vlogf()
+			if (rec_pos + sizeof(len) + (v ? len : 0) > rec_end) {
+				overflow = 1;
+				break;
+			}
+			blog_put(rec_pos, rec_end, len);
+			if (v) {
+				memcpy(rec_pos, v, len);
+				rec_pos += len;
+			}
+			break;
+		}
+		default:
+			(void)va_arg(va, void*);
+			break;
+		}
+	}
+	va_end(va);
+	if (overflow) return -1;
+	hdr.iov_base = rec;
+	hdr.iov_len = rec_pos - rec;
+	return moss_buf_msg_push(blog->buf, &hdr, NULL, 1) == 1 ? 0 : -1;
+}
+
+/* Take from record memory. */
+#define blog_get(_rec, _rec_end, _v) if ((_rec) + sizeof(_v) <= (_rec_end)) { \
+	memcpy(&(_v), _rec, sizeof(_v)); \
+	(_rec) += sizeof(_v); \
+} else { \
+	return -1; \
+}
+
+/* Decode the message of record to text. */
+static int blog_decode_msg(const char *fmt, const char *rec,
+		const char *rec_end, moss_buf_t *txt) {
+	char spec[32], str[MOSS_LOG_LINE_MAX];
+	const char *conv;
+	unsigned char argt[3];
+	int argc, star[2], star_cnt, spec_len, i, r = 0;
+
+	for (; *fmt && r == 0; fmt = conv + spec_len) {
+		if (!(conv = strchr(fmt, '%'))) conv = fmt + strlen(fmt);
+		if (conv > fmt && moss_buf_write(txt, fmt, conv - fmt) != 0) return -1;
+		if (!*conv) break;
+		spec_len = blog_fmt_conv(conv, argt, &argc);
+		if ((size_t)spec_len >= sizeof(spec) || argc < 0) return -1;
+		if (argc == 0) {
+			// literal %%
+			r = moss_buf_write(txt, "%", 1) == 0 ? 0 : -1;
+			continue;
+		}
+		memcpy(spec, conv, spec_len);
+		spec[spec_len] = '\0';
+		for (star_cnt = 0, i = 0; i < argc - 1; i++) {
+			int32_t v;
+
+			blog_get(rec, rec_end, v);
+			star[star_cnt++] = v;
+		}
+
+#define blog_printf(_v) (star_cnt == 0 ? moss_buf_printf(txt, spec, _v) : \
+		star_cnt == 1 ? moss_buf_printf(txt, spec, star[0], _v) : \
+		moss_buf_printf(txt, spec, star[0], star[1], _v))
+
+		switch (argt[argc - 1]) {
+		case blog_arg_int: {
+			int32_t v;
+
+			blog_get(rec, rec_end, v);
+			r = blog_printf((int)v);
+			break;
+		}
+		case blog_arg_long:
+		case blog_arg_llong:
+		case blog_arg_size:
+		case blog_arg_intmax:
+		case blog_arg_ptrdiff:
+		case blog_arg_ptr: {
+			int64_t v;
+
+			blog_get(rec, rec_end, v);
+			switch (argt[argc - 1]) {
+			case blog_arg_long:
+				r = blog_printf((long)v);
+				break;
+			case blog_arg_llong:
+				r = blog_printf((long long)v);
+				break;
+			case blog_arg_size:
+				r = blog_printf((size_t)v);
+				break;
+			case blog_arg_intmax:
+				r = blog_printf((intmax_t)v);
+				break;
+			case blog_arg_ptrdiff:
+				r = blog_printf((ptrdiff_t)v);
+				break;
+			default:
+				r = blog_printf((void*)(intptr_t)v);
+				break;
+			}
+			break;
+		}
+		case blog_arg_double: {
+			double v;
+
+			blog_get(rec, rec_end, v);
+			r = blog_printf(v);
+			break;
+		}
+		case blog_arg_ldouble: {
+			long double v;
+
+			blog_get(rec, rec_end, v);
+			r = blog_printf(v);
+			break;
+		}
+		case blog_arg_str: {
+			uint32_t len;
+
+			blog_get(rec, rec_end, len);
+			if (len == (uint32_t)-1) {
+				r = blog_printf((char*)NULL);
+				break;
+			}
+			if (rec + len > rec_end || len >= sizeof(str)) return -1;
+			memcpy(str, rec, len);
+			str[len] = '\0';
+			rec += len;
+			r = blog_printf(str);
+			break;
+		}
+		default:
+			break;
+		}
+#undef blog_printf
+	}
+	return r;
+}
+
+int moss_blog_decode(moss_blog_decoder_t *dec, moss_buf_t *buf,
+		moss_buf_t *txt) {
+	struct moss_blog_decoder_site_rec *site;
+	const char *rec, *rec_end;
+	moss_iov_t msg;
+	size_t txt_pos, txt_lmt;
+	uint32_t id;
+	int cnt;
+
+	for (cnt = 0; moss_buf_msg_peek(buf, &msg, 1) == 1; cnt++) {
+		rec = (char*)msg.iov_base;
+		rec_end = rec + msg.iov_len;
+		blog_get(rec, rec_end, id);
+
+		if (id & BLOG_DEF) {
+			int32_t lvl;
+			int64_t lno;
+			const char *tag = NULL;
+
+			id &= ~BLOG_DEF;
+			blog_get(rec, rec_end, lvl);
+			blog_get(rec, rec_end, lno);
+			if (!(tag = memchr(rec, '\0', rec_end - rec)) ||
+					!memchr(tag + 1, '\0', rec_end - tag - 1)) {
+				return -1;
+			}
+			if (id >= dec->site_cnt) {
+				if (!(site = realloc(dec->site, sizeof(*site) * (id + 1)))) {
+					return cnt;
+				}
+				memset(site + dec->site_cnt, 0,
+						sizeof(*site) * (id + 1 - dec->site_cnt));
+				dec->site = site;
+				dec->site_cnt = id + 1;
+			}
+			site = &dec->site[id];
+			free(site->tag);
+			free(site->fmt);
+			site->lvl = lvl;
+			site->lno = lno;
+			site->tag = strdup(rec);
+			site->fmt = strdup(tag + 1);
+			moss_buf_msg_pop(buf, &msg, 1);
+			continue;
+		}
+
+		{
+			char tm_str[32];
+			moss_buf_t tm_buf = {.data = tm_str, .cap = sizeof(tm_str) / 2};
+			uint64_t ts;
+
+			blog_get(rec, rec_end, ts);
+			if (id >= dec->site_cnt || !(site = &dec->site[id])->fmt) {
+				return -1;
+			}
+			if (ts == 0 || moss_log_ts_str(&tm_buf, ts) != 0) {
+				((char*)tm_buf.data)[tm_buf.lmt = 0] = '\0';
+			} else {
+				((char*)tm_buf.data)[tm_buf.lmt++] = ' ';
+				((char*)tm_buf.data)[tm_buf.lmt++] = '\0';
+			}
+			// keep the text untouched when insufficient space
+			txt_pos = txt->pos;
+			txt_lmt = txt->lmt;
+			if (moss_buf_printf(txt, "%s %s%s #%ld ",
+					moss_level_str(site->lvl & moss_log_level_mask, ""),
+					tm_str, site->tag, site->lno) != 0 ||
+					blog_decode_msg(site->fmt, rec, rec_end, txt) != 0) {
+				txt->pos = txt_pos;
+				txt->lmt = txt_lmt;
+				return cnt;
+			}
+		}
+		moss_buf_msg_pop(buf, &msg, 1);
+	}
+	return cnt;
+}
+
+void moss_blog_decoder_free(moss_blog_decoder_t *dec) {
+	unsigned i;
+
+	for (i = 0; i < dec->site_cnt; i++) {
+		free(dec->site[i].tag);
+		free(dec->site[i].fmt);
+	}
+	free(dec->site);
+	dec->site = NULL;
+	dec->site_cnt = 0;
+}
+
+/* Append to moss buffer, all or fail. */
+#define kv_put(_buf, _data, _sz) if ((_buf)->cap - (_buf)->lmt < (_sz) || \
+		moss_buf_write(_buf, _data, _sz) != 0) { \
+	return -1; \
+}
+
+/* Append string to logfmt line, quote when necessary. */
+static int kv_logfmt_str(moss_buf_t *buf, const char *str, size_t len) {
+	static const char esc[] = "\\\\\"\"\nn\rr\tt";
+	const char *run, *end = str + len, *e;
+	int quote = len <= 0;
+	char ch[2];
+
+	for (run = str; run < end && !quote; run++) {
+		if ((unsigned char)*run <= ' ' || *run == '=' || *run == '"') {
+			quote = 1;
+		}
+	}
+	if (!quote) {
+		kv_put(buf, str, len);
+		return 0;
+	}
+	kv_put(buf, "\"", 1);
+	for (run = str; str < end; str++) {
+		for (e = esc; *e && *e != *str; e += 2);
+		if (!*e) continue;
+		kv_put(buf, run, (size_t)(str - run));
+		ch[0] = '\\';
+		ch[1] = e[1];
+		kv_put(buf, ch, 2);
+		run = str + 1;
+	}
+	kv_put(buf, run, (size_t)(str - run));
+	kv_put(buf, "\"", 1);
+	return 0;
+}
+
+/* Append key to logfmt line. */
+static int kv_logfmt_key(moss_buf_t *buf, const char *key, size_t key_len,
+		int first) {
+	if (!first) kv_put(buf, " ", 1);
+	kv_put(buf, key, key_len);
+	kv_put(buf, "=", 1);
+	return 0;
+}
+
+/* Append pair to logfmt line. */
+static int kv_logfmt(moss_buf_t *buf, const char *key, size_t key_len,
+		const moss_log_kv_t *kv, int first) {
+	if (kv_logfmt_key(buf, key, key_len, first) != 0) return -1;
+	switch (kv->type) {
+	case moss_log_kv_type_int:
+		return moss_buf_printf(buf, "%lld", kv->v.i);
+	case moss_log_kv_type_dbl:
+		return moss_buf_printf(buf, "%.17g", kv->v.d);
+	case moss_log_kv_type_str:
+		if (!kv->v.s) return kv_logfmt_str(buf, "", 0);
+		return kv_logfmt_str(buf, kv->v.s, strlen(kv->v.s));
+	}
+	return -1;
+}
+
+/* Append field to binary record. */
+static int kv_tlv(moss_buf_t *buf, const char *key, size_t key_len,
+		const moss_log_kv_t *kv, int first) {
+	uint8_t type = kv->type, len = key_len > 255 ? 255 : key_len;
+	uint32_t str_len;
+
+	(void)first;
+	kv_put(buf, &type, sizeof(type));
+	kv_put(buf, &len, sizeof(len));
+	kv_put(buf, key, len);
+	switch (kv->type) {
+	case moss_log_kv_type_int: {
+		int64_t v = kv->v.i;
+		kv_put(buf, &v, sizeof(v));
+		return 0;
+	}
+	case moss_log_kv_type_dbl:
+		kv_put(buf, &kv->v.d, sizeof(kv->v.d));
+		return 0;
+	case moss_log_kv_type_str:
+		str_len = kv->v.s ? strlen(kv->v.s) : 0;
+		kv_put(buf, &str_len, sizeof(str_len));
+		kv_put(buf, kv->v.s, str_len);
+		return 0;
+	}
+	return -1;
+}
+
+int moss_log_kv_encode(moss_buf_t *buf, int enc, unsigned lvl,
+		const char *tag, long lno, unsigned long long ts,
+		const moss_log_kv_t *kv, int cnt) {
+	int (*put)(moss_buf_t*, const char*, size_t, const moss_log_kv_t*, int);
+	moss_log_kv_t hdr[4] = {
+		MOSS_KV_STR("lvl", moss_level_str(lvl & moss_log_level_mask, "")),
+		MOSS_KV_INT("ts", ts), MOSS_KV_STR("tag", tag), MOSS_KV_INT("lno", lno),
+	};
+	size_t lmt = buf->lmt, len_pos = 0;
+	uint32_t len = 0;
+	int i;
+
+	if (enc == moss_log_kv_enc_tlv) {
+		hdr[0] = MOSS_KV_INT("lvl", lvl & moss_log_level_mask);
+		put = &kv_tlv;
+		// length updated at the end
+		len_pos = buf->pos + buf->lmt;
+		kv_put(buf, &len, sizeof(len));
+	} else {
+		put = &kv_logfmt;
+	}
+	for (i = 0; i < (int)MOSS_ARRAYSIZE(hdr) + cnt; i++) {
+		const moss_log_kv_t *pair = i < (int)MOSS_ARRAYSIZE(hdr) ? &hdr[i] :
+				&kv[i - MOSS_ARRAYSIZE(hdr)];
+
+		if ((*put)(buf, pair->key, strlen(pair->key), pair, i == 0) != 0) {
+			buf->lmt = lmt;
+			return -1;
+		}
+	}
+	if (enc == moss_log_kv_enc_tlv) {
+		len = buf->lmt - lmt - sizeof(len);
+		for (i = 0; i < (int)sizeof(len); i++) {
+			((char*)buf->data)[buf_wrap(buf, len_pos + i)] = ((char*)&len)[i];
+		}
+	} else if (buf->cap - buf->lmt < 1 || moss_buf_write(buf, "\n", 1) != 0) {
+		buf->lmt = lmt;
+		return -1;
+	}
+	return 0;
+}
+
+/* Take from binary record. */
+#define kv_get(_rec, _rec_end, _v, _sz) if ((_rec) + (_sz) <= (_rec_end)) { \
+	memcpy(_v, _rec, _sz); \
+	(_rec) += (_sz); \
+} else { \
+	return -1; \
+}
+
+int moss_log_kv_decode(const void *rec, size_t sz, moss_buf_t *txt) {
+	const char *pos = (const char*)rec, *rec_end, *key;
+	size_t lmt = txt->lmt;
+	moss_log_kv_t kv;
+	uint32_t len;
+	uint8_t type, key_len;
+
+	kv_get(pos, (const char*)rec + sz, &len, sizeof(len));
+	if (len > sz - sizeof(len)) return -1;
+	rec_end = pos + len;
+	while (pos < rec_end) {
+		kv_get(pos, rec_end, &type, sizeof(type));
+		kv_get(pos, rec_end, &key_len, sizeof(key_len));
+		if (pos + key_len > rec_end) return -1;
+		key = pos;
+		pos += key_len;
+		kv.type = type;
+		switch (type) {
+		case moss_log_kv_type_int: {
+			int64_t v;
+			kv_get(pos, rec_end, &v, sizeof(v));
+			kv.v.i = v;
+			// level shown as text same as logfmt encoding
+			if (key_len == 3 && memcmp(key, "lvl", 3) == 0) {
+				kv.type = moss_log_kv_type_str;
+				kv.v.s = moss_level_str(v, "");
+			}
+			break;
+		}
+		case moss_log_kv_type_dbl:
+			kv_get(pos, rec_end, &kv.v.d, sizeof(kv.v.d));
+			break;
+		case moss_log_kv_type_str: {
+			uint32_t str_len;
+
+			kv_get(pos, rec_end, &str_len, sizeof(str_len));
+			if (str_len > (size_t)(rec_end - pos)) return -1;
+			if (kv_logfmt_key(txt, key, key_len, txt->lmt == lmt) != 0
+					|| kv_logfmt_str(txt, pos, str_len) != 0) {
+				txt->lmt = lmt;
+				return -1;
+			}
+			pos += str_len;
+			continue;
+		}
+		default:
+			return -1;
+		}
+		if (kv_logfmt(txt, key, key_len, &kv, txt->lmt == lmt) != 0) {
+			txt->lmt = lmt;
+			return -1;
+		}
+	}
+	if (txt->cap - txt->lmt < 1 || moss_buf_write(txt, "\n", 1) != 0) {
+		txt->lmt = lmt;
+		return -1;
+	}
+	return sizeof(len) + len;
+}
+
+int moss_log_kv(unsigned lvl, const char *tag, long lno,
+		const moss_log_kv_t *kv, int cnt) {
+	char mem[MOSS_LOG_LINE_MAX];
+	moss_buf_t buf = {.data = mem, .cap = sizeof(mem)};
+	moss_log_sink_t *sink;
+	unsigned long long ts;
+	unsigned long rep;
+	int enc, r;
+
+	if (!moss_log_enabled(lvl, tag)
+			|| moss_log_ratelimit_check(tag, lno, &rep) != 0) {
+		return 0;
+	}
+	sink = moss_log_sink_get();
+	enc = sink ? sink->kv_enc : moss_log_kv_enc_logfmt;
+	ts = moss_log_ts();
+	if (rep > 0) {
+		moss_log_kv_t kv_rep = MOSS_KV_INT("repeated", rep);
+
+		if (moss_log_kv_encode(&buf, enc, lvl, tag, lno, ts, &kv_rep, 1) == 0) {
+			moss_log_write(buf.data, buf.lmt);
+		}
+		buf.lmt = 0;
+	}
+	while ((r = moss_log_kv_encode(&buf, enc, lvl, tag, lno, ts, kv,
+			cnt)) != 0 && buf.cap < MOSS_LOG_LINE_EXPAND_MAX) {
+		void *data;
+		size_t cap = MOSS_MIN(buf.cap * 4, MOSS_LOG_LINE_EXPAND_MAX);
+
+		if (!(data = malloc(cap))) break;
+		if (buf.data != mem) free(buf.data);
+		buf.data = data;
+		buf.cap = cap;
+		buf.pos = buf.lmt = 0;
+	}
+	if (r == 0) r = moss_log_write(buf.data, buf.lmt);
+	if (buf.data != mem) free(buf.data);
+	return r;
+}
+
+int moss_readline(int (*getc)(void *arg), void *arg, char *_nl)
+{
+	int c, n;
+	char nl;
+
+	for (n = 0, nl = 0; (c = (*getc)(arg)) >= 0; n++) {
+		if (c == MOSS_LF) {
+			if (_nl) *_nl = nl + 1;
+			return n - nl;
+		}
+		nl = (c == MOSS_CR);
+	}
+	if (_nl) *_nl = 0;
+	return (n <= 0) ? -1 : n;
+}
+
+int moss_log_level_max = moss_log_level_info;
+
+int moss_log_level_tag_max = -1;
+
+/* Per tag override, open addressing and never release slot. */
+static struct {
+	const char *tag;
+	int lvl;
+} log_level_tag[MOSS_LOG_LEVEL_TAG_MAX];
+
+static unsigned log_level_tag_hash(const char *tag) {
+	unsigned h = 2166136261u;
+
+	while (*tag) h = (h ^ (unsigned char)*tag++) * 16777619u;
+	return h;
+}
+
+int moss_log_level_tag_get(const char *tag) {
+	unsigned h = log_level_tag_hash(tag), i;
+	const char *slot_tag;
+
+	for (i = 0; i < MOSS_LOG_LEVEL_TAG_MAX; i++) {
+		int slot = (h + i) % MOSS_LOG_LEVEL_TAG_MAX;
+
+		if (!(slot_tag = __atomic_load_n(&log_level_tag[slot].tag,
+				__ATOMIC_ACQUIRE))) {
+			break;
+		}
+		if (strcmp(slot_tag, tag) == 0) {
+			return __atomic_load_n(&log_level_tag[slot].lvl, __ATOMIC_RELAXED);
+		}
+	}
+	return -1;
+}
+
+int moss_log_level_tag_set(const char *tag, int lvl) {
+	unsigned h = log_level_tag_hash(tag), i;
+	const char *slot_tag;
+	char *tag_dup = NULL;
+	int slot, lvl_max;
+
+	for (i = 0; i < MOSS_LOG_LEVEL_TAG_MAX; i++) {
+		slot = (h + i) % MOSS_LOG_LEVEL_TAG_MAX;
+		if (!(slot_tag = __atomic_load_n(&log_level_tag[slot].tag,
+				__ATOMIC_ACQUIRE))) {
+			if (lvl < 0) break;
+			if (!tag_dup && !(tag_dup = strdup(tag))) return -1;
+			if (!__atomic_compare_exchange_n(&log_level_tag[slot].tag,
+					&slot_tag, tag_dup, 0, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE)) {
+				// taken by another thread, check again
+				i--;
+				continue;
+			}
+			// level for the slot claimed, not the slot of other tag
+			__atomic_store_n(&log_level_tag[slot].lvl, lvl, __ATOMIC_RELAXED);
+			tag_dup = NULL;
+			break;
+		}
+		if (strcmp(slot_tag, tag) == 0) {
+			__atomic_store_n(&log_level_tag[slot].lvl, lvl, __ATOMIC_RELAXED);
+			break;
+		}
+	}
+	if (tag_dup) free(tag_dup);
+	if (i >= MOSS_LOG_LEVEL_TAG_MAX) return -1;
+
+	for (lvl_max = -1, i = 0; i < MOSS_LOG_LEVEL_TAG_MAX; i++) {
+		if (__atomic_load_n(&log_level_tag[i].tag, __ATOMIC_ACQUIRE)) {
+			lvl = __atomic_load_n(&log_level_tag[i].lvl, __ATOMIC_RELAXED);
+			if (lvl > lvl_max) lvl_max = lvl;
+		}
+	}
+	__atomic_store_n(&moss_log_level_tag_max, lvl_max, __ATOMIC_RELAXED);
+	return 0;
+}
+
+/* Per call site rate limit, GCRA keep the bucket in single word.
+ *
+ * - tat: theoretical arrival time, pass when now + tol >= tat.
+ */
+static unsigned long log_rl_intv, log_rl_tol;
+
+static struct {
+	uint64_t key, tat;
+	unsigned long rep;
+} log_rl_site[MOSS_LOG_RATELIMIT_SITE_MAX];
+
+int moss_log_ratelimit(unsigned burst, unsigned rate) {
+	unsigned long intv;
+
+	if (burst <= 0 || rate <= 0) {
+		__atomic_store_n(&log_rl_intv, 0, __ATOMIC_RELEASE);
+		return 0;
+	}
+	if ((intv = 1000000 / rate) <= 0) intv = 1;
+	__atomic_store_n(&log_rl_tol, intv * (burst - 1), __ATOMIC_RELAXED);
+	__atomic_store_n(&log_rl_intv, intv, __ATOMIC_RELEASE);
+	return 0;
+}
+
+int moss_log_ratelimit_check(const char *tag, long lno, unsigned long *rep) {
+	unsigned long intv = __atomic_load_n(&log_rl_intv, __ATOMIC_ACQUIRE), tol;
+	uint64_t key, key0, now, tat, tat_new;
+	unsigned i, slot;
+
+	*rep = 0;
+	if (intv <= 0 || (now = moss_ts1_get(NULL)) == 0) return 0;
+	tol = __atomic_load_n(&log_rl_tol, __ATOMIC_RELAXED);
+
+	key = ((uint64_t)(uintptr_t)tag * 0x9e3779b97f4a7c15ULL) ^ (uint64_t)lno;
+	if (key == 0) key = 1;
+	for (i = 0; i < MOSS_LOG_RATELIMIT_SITE_MAX; i++) {
+		slot = (unsigned)((key >> 32) + i) % MOSS_LOG_RATELIMIT_SITE_MAX;
+		key0 = __atomic_load_n(&log_rl_site[slot].key, __ATOMIC_RELAXED);
+		if (key0 == 0 && __atomic_compare_exchange_n(&log_rl_site[slot].key,
+				&key0, key, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+			break;
+		}
+		if (key0 == key) break;
+	}
+	// not limit when no more slot
+	if (i >= MOSS_LOG_RATELIMIT_SITE_MAX) return 0;
+
+	tat = __atomic_load_n(&log_rl_site[slot].tat, __ATOMIC_RELAXED);
+	do {
+		if (now + tol < tat) {
+			__atomic_fetch_add(&log_rl_site[slot].rep, 1, __ATOMIC_RELAXED);
+			return -1;
+		}
+		tat_new = (tat > now ? tat : now) + intv;
+	} while (!__atomic_compare_exchange_n(&log_rl_site[slot].tat, &tat,
+			tat_new, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+	if (__atomic_load_n(&log_rl_site[slot].rep, __ATOMIC_RELAXED) > 0) {
+		*rep = __atomic_exchange_n(&log_rl_site[slot].rep, 0, __ATOMIC_RELAXED);
+	}
+	return 0;
+}
+
+static moss_log_sink_t *log_sink;
+
+moss_log_sink_t *moss_log_sink_set(moss_log_sink_t *sink) {
+	return __atomic_exchange_n(&log_sink, sink, __ATOMIC_ACQ_REL);
+}
+
+moss_log_sink_t *moss_log_sink_get(void) {
+	return __atomic_load_n(&log_sink, __ATOMIC_ACQUIRE);
+}
+
+static int log_sink_mem_write(moss_log_sink_t *sink, const moss_iov_t *iov,
+		int cnt) {
+	moss_log_sink_mem_t *mem = (moss_log_sink_mem_t*)sink->priv;
+	size_t sz = 0;
+	int i, r = 0;
+
+	for (i = 0; i < cnt; i++) sz += iov[i].iov_len;
+	while (__atomic_exchange_n(&mem->lock, 1, __ATOMIC_ACQUIRE));
+	if (mem->buf->cap - mem->buf->lmt < sz) {
+		mem->dropped += cnt;
+		r = -1;
+	} else {
+		for (i = 0; i < cnt; i++) {
+			moss_buf_write(mem->buf, iov[i].iov_base, iov[i].iov_len);
+		}
+	}
+	__atomic_store_n(&mem->lock, 0, __ATOMIC_RELEASE);
+	return r;
+}
+
+moss_log_sink_t *moss_log_sink_mem_init(moss_log_sink_mem_t *mem,
+		moss_buf_t *buf) {
+	mem->sink.write = &log_sink_mem_write;
+	mem->sink.flush = NULL;
+	mem->sink.priv = mem;
+	mem->sink.kv_enc = moss_log_kv_enc_logfmt;
+	mem->buf = buf;
+	mem->lock = 0;
+	mem->dropped = 0;
+	return &mem->sink;
+}
+
+#ifdef __GNUC__
+void moss_matrix_mul_v4sf(int am, int an, float *a, int bn, float *b,
+		float *c) {
+	int m, n;
+
+	for (m = 0; m < am; m++) {
+		for (n = 0; n < bn; n++) {
+			v4sf_t va, vb, vc;
+
+			switch(an) {
+			case 4:
+				va[3] = a[3]; vb[3] = b[n + bn + bn + bn];
+			case 3:
+				va[2] = a[2]; vb[2] = b[n + bn + bn];
+			case 2:
+				va[1] = a[1]; vb[1] = b[n + bn];
+			case 1:
+			default:
+				va[0] = a[0]; vb[0] = b[n];
+			}
+
+			vc = va * vb;
+			*c = vc[0];
+
+			switch(an) {
+			case 4:
+				*c += vc[3];
+			case 3:
+				*c += vc[2];
+			case 2:
+				*c += vc[1];
+			case 1:
+			default:
 				;
 			}
 			c++;
@@ -219,15 +1768,666 @@ void moss_matrix_mul_sw(int am, int an, float *a, int bn, float *b,
 	}
 }
 
+#ifdef __GNUC__
+/* Blocking for packed matrix multiply, C tile MR * NR in vector register,
+ * packed A MC * KC stay in L2 and packed B KC * NC in L3.
+ */
+#define SGEMM_MR 4
+#define SGEMM_MC 64
+#define SGEMM_KC 256
+#define SGEMM_NC 1024
+
+/* Compute C tile from packed A and B, start from zero or C. */
+typedef void (*sgemm_kern_t)(int kc, const float *pa, const float *pb,
+		float *c, int ldc, int mr, int nr, int zero);
+
+/* Kernel of 2 vectors per row, each C element accumulated in k order. */
+#define SGEMM_KERN(_name, _vt, _attr) \
+static _attr void _name(int kc, const float *pa, const float *pb, \
+		float *c, int ldc, int mr, int nr, int zero) { \
+	enum { vl = sizeof(_vt) / sizeof(float) }; \
+	_vt acc[SGEMM_MR][2], b0, b1; \
+	float t[SGEMM_MR][vl * 2]; \
+	int i, k, full = mr >= SGEMM_MR && nr >= vl * 2; \
+\
+	memset(acc, 0, sizeof(acc)); \
+	if (!zero) { \
+		for (i = 0; i < SGEMM_MR; i++) { \
+			if (full) { \
+				memcpy(acc[i], c + i * ldc, sizeof(acc[i])); \
+			} else if (i < mr) { \
+				memset(t[i], 0, sizeof(t[i])); \
+				memcpy(t[i], c + i * ldc, sizeof(float) * MOSS_MIN(nr, vl * 2)); \
+				memcpy(acc[i], t[i], sizeof(acc[i])); \
+			} \
+		} \
+	} \
+	for (k = 0; k < kc; k++) { \
+		memcpy(&b0, pb, sizeof(b0)); \
+		memcpy(&b1, pb + vl, sizeof(b1)); \
+		pb += vl * 2; \
+		for (i = 0; i < SGEMM_MR; i++) { \
+			acc[i][0] += pa[i] * b0; \
+			acc[i][1] += pa[i] * b1; \
+		} \
+		pa += SGEMM_MR; \
+	} \
+	for (i = 0; i < SGEMM_MR && i < mr; i++) { \
+		if (full) { \
+			memcpy(c + i * ldc, acc[i], sizeof(acc[i])); \
+		} else { \
+			memcpy(t[i], acc[i], sizeof(acc[i])); \
+			memcpy(c + i * ldc, t[i], sizeof(float) * MOSS_MIN(nr, vl * 2)); \
+		} \
+	} \
+}
+
+SGEMM_KERN(sgemm_kern_v4sf, v4sf_t, )
+#if defined(__x86_64__) || defined(__i386__)
+SGEMM_KERN(sgemm_kern_v8sf, v8sf_t, __attribute__((target("avx2,fma"))))
+SGEMM_KERN(sgemm_kern_v16sf, v16sf_t, __attribute__((target("avx512f"))))
+#endif
+
+/* Vector extension available on the cpu. */
+enum {
+	matrix_isa_v4sf = 1,
+	matrix_isa_v8sf,
+	matrix_isa_v16sf,
+};
+
+static int matrix_isa_get(void) {
+	static int isa = 0;
+	int r;
+
+	if ((r = __atomic_load_n(&isa, __ATOMIC_RELAXED))) return r;
+	r = matrix_isa_v4sf;
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f")) {
+		r = matrix_isa_v16sf;
+	} else if (__builtin_cpu_supports("avx2")
+			&& __builtin_cpu_supports("fma")) {
+		r = matrix_isa_v8sf;
+	}
+#endif
+	__atomic_store_n(&isa, r, __ATOMIC_RELAXED);
+	return r;
+}
+
+static struct {
+	sgemm_kern_t kern;
+	int nr;
+} sgemm_impl;
+
+/* Select kernel for the cpu once. */
+static void sgemm_impl_init(void) {
+	int nr = sizeof(v4sf_t) / sizeof(float) * 2;
+	sgemm_kern_t kern = &sgemm_kern_v4sf;
+
+#if defined(__x86_64__) || defined(__i386__)
+	switch (matrix_isa_get()) {
+	case matrix_isa_v16sf:
+		kern = &sgemm_kern_v16sf;
+		nr = sizeof(v16sf_t) / sizeof(float) * 2;
+		break;
+	case matrix_isa_v8sf:
+		kern = &sgemm_kern_v8sf;
+		nr = sizeof(v8sf_t) / sizeof(float) * 2;
+		break;
+	}
+#endif
+	__atomic_store_n(&sgemm_impl.nr, nr, __ATOMIC_RELAXED);
+	__atomic_store_n(&sgemm_impl.kern, kern, __ATOMIC_RELEASE);
+}
+
+/* Pack A rows to MR interleaved per k, element (i, k) at a[i * rs + k * cs],
+ * zero padded.
+ */
+static void sgemm_pack_a(int mc, int kc, const float *a, int rs, int cs,
+		float alpha, float *pa) {
+	float *pa_end = pa;
+	int i, k, r;
+
+	for (i = 0; i < mc; i += SGEMM_MR) {
+		if (i + SGEMM_MR <= mc) {
+			for (k = 0; k < kc; k++) {
+				for (r = 0; r < SGEMM_MR; r++) {
+					*pa_end++ = a[(i + r) * rs + k * cs];
+				}
+			}
+			continue;
+		}
+		for (k = 0; k < kc; k++) {
+			for (r = 0; r < SGEMM_MR; r++) {
+				*pa_end++ = i + r < mc ? a[(i + r) * rs + k * cs] : 0.0f;
+			}
+		}
+	}
+	// scale once here instead of each product
+	if (alpha != 1.0f) for (; pa < pa_end; pa++) *pa *= alpha;
+}
+
+/* Pack B columns to nr interleaved per k, element (k, j) at
+ * b[k * rs + j * cs], zero padded.
+ */
+static void sgemm_pack_b(int kc, int nc, int nr, const float *b, int rs,
+		int cs, float *pb) {
+	int j, k, r;
+
+	for (j = 0; j < nc; j += nr) {
+		if (j + nr <= nc && cs == 1) {
+			for (k = 0; k < kc; k++) {
+				memcpy(pb, b + k * rs + j, sizeof(float) * nr);
+				pb += nr;
+			}
+			continue;
+		}
+		for (k = 0; k < kc; k++) {
+			for (r = 0; r < nr; r++) {
+				*pb++ = j + r < nc ? b[k * rs + (j + r) * cs] : 0.0f;
+			}
+		}
+	}
+}
+
+#define SGEMM_STACK_MAX 1024
+
+/* c[m][n] (ldc) += alpha * op(a)[m][k] * op(b)[k][n], element of op(a) at
+ * a[i * a_rs + k * a_cs] and op(b) at b[k * b_rs + j * b_cs], start from
+ * zero when zero set.
+ */
+static void sgemm_blocked(int m, int n, int k, float alpha, const float *a,
+		int a_rs, int a_cs, const float *b, int b_rs, int b_cs, float *c,
+		int ldc, int zero) {
+	float stack_mem[SGEMM_STACK_MAX + 32], *mem = stack_mem, *pa, *pb;
+	sgemm_kern_t kern;
+	int nr, mc_max, kc_max, nc_max, jc, pc, ic, jr, ir, mc, kc, nc;
+	size_t pa_sz, pb_sz;
+
+	if (m <= 0 || n <= 0) return;
+	if (k <= 0) {
+		for (ic = 0; zero && ic < m; ic++) {
+			memset(c + ic * ldc, 0, sizeof(float) * n);
+		}
+		return;
+	}
+	if (!(kern = __atomic_load_n(&sgemm_impl.kern, __ATOMIC_ACQUIRE))) {
+		sgemm_impl_init();
+		kern = sgemm_impl.kern;
+	}
+	nr = sgemm_impl.nr;
+
+	mc_max = MOSS_MIN(m + SGEMM_MR - 1, SGEMM_MC) / SGEMM_MR * SGEMM_MR;
+	kc_max = MOSS_MIN(k, SGEMM_KC);
+	nc_max = MOSS_MIN(n + nr - 1, SGEMM_NC) / nr * nr;
+	pa_sz = (size_t)mc_max * kc_max;
+	pb_sz = (size_t)kc_max * nc_max;
+	if (pa_sz + pb_sz > SGEMM_STACK_MAX && !(mem = (float*)malloc(
+			sizeof(float) * (pa_sz + pb_sz + 32)))) {
+		// no memory, go on with small blocks fit the stack
+		mem = stack_mem;
+		mc_max = SGEMM_MR;
+		nc_max = nr;
+		kc_max = MOSS_MIN(k, SGEMM_STACK_MAX / (mc_max + nc_max) / 16 * 16);
+		pa_sz = (size_t)mc_max * kc_max;
+	}
+	// align for vector load
+	pa = (float*)(((uintptr_t)mem + 63) & ~(uintptr_t)63);
+	pb = pa + (pa_sz + 15) / 16 * 16;
+
+	for (jc = 0; jc < n; jc += nc) {
+		nc = MOSS_MIN(n - jc, nc_max);
+		for (pc = 0; pc < k; pc += kc) {
+			kc = MOSS_MIN(k - pc, kc_max);
+			sgemm_pack_b(kc, nc, nr, b + pc * b_rs + jc * b_cs, b_rs, b_cs, pb);
+			for (ic = 0; ic < m; ic += mc) {
+				mc = MOSS_MIN(m - ic, mc_max);
+				sgemm_pack_a(mc, kc, a + ic * a_rs + pc * a_cs, a_rs, a_cs,
+						alpha, pa);
+				for (jr = 0; jr < nc; jr += nr) {
+					for (ir = 0; ir < mc; ir += SGEMM_MR) {
+						(*kern)(kc, pa + ir * kc, pb + jr * kc,
+								c + (ic + ir) * ldc + jc + jr, ldc,
+								mc - ir, nc - jr, zero && pc == 0);
+					}
+				}
+			}
+		}
+	}
+	if (mem != stack_mem) free(mem);
+}
+#endif
+
 void moss_matrix_mul(int am, int an, float *a, int bn, float *b,
 		float *c) {
-#if defined(__GNUC__) && 0
-	if (an <= 4) {
-		moss_matrix_mul_v4sf(am, an, a, bn, b, c);
+	moss_matrix_mul_ld(am, an, a, an, bn, b, bn, c, bn);
+}
+
+#ifdef __GNUC__
+/* Batched products in vector lanes, return count of product done. */
+typedef int (*mat_batch_kern_t)(int am, int an, int bn, int cnt,
+		const float *a, const float *b, float *c, int ld);
+
+/* Kernel for n * n, unrolled when n constant. */
+#define MAT_BATCH_KERN_N(_name, _vt, _attr, _n) \
+static _attr int _name(int am, int an, int bn, int cnt, const float *a, \
+		const float *b, float *c, int ld) { \
+	enum { vl = sizeof(_vt) / sizeof(float) }; \
+	_vt va[_n * _n], vb[_n * _n], vc; \
+	int p, i, j, k; \
+\
+	/* size fixed to _n, keep the kernel signature */ \
+	(void)am; (void)an; (void)bn; \
+	for (p = 0; p + vl <= cnt; p += vl) { \
+		_Pragma("GCC unroll 16") \
+		for (i = 0; i < _n * _n; i++) { \
+			memcpy(&va[i], a + i * ld + p, sizeof(va[i])); \
+			memcpy(&vb[i], b + i * ld + p, sizeof(vb[i])); \
+		} \
+		_Pragma("GCC unroll 4") \
+		for (i = 0; i < _n; i++) { \
+			_Pragma("GCC unroll 4") \
+			for (j = 0; j < _n; j++) { \
+				vc = va[i * _n] * vb[j]; \
+				_Pragma("GCC unroll 4") \
+				for (k = 1; k < _n; k++) { \
+					vc += va[i * _n + k] * vb[k * _n + j]; \
+				} \
+				memcpy(c + (i * _n + j) * ld + p, &vc, sizeof(vc)); \
+			} \
+		} \
+	} \
+	return p; \
+}
+
+/* Kernel for any size. */
+#define MAT_BATCH_KERN(_name, _vt, _attr) \
+static _attr int _name(int am, int an, int bn, int cnt, const float *a, \
+		const float *b, float *c, int ld) { \
+	enum { vl = sizeof(_vt) / sizeof(float) }; \
+	_vt va, vb, vc; \
+	int p, i, j, k; \
+\
+	for (p = 0; p + vl <= cnt; p += vl) { \
+		for (i = 0; i < am; i++) { \
+			for (j = 0; j < bn; j++) { \
+				memcpy(&va, a + (i * an) * ld + p, sizeof(va)); \
+				memcpy(&vb, b + j * ld + p, sizeof(vb)); \
+				vc = va * vb; \
+				for (k = 1; k < an; k++) { \
+					memcpy(&va, a + (i * an + k) * ld + p, sizeof(va)); \
+					memcpy(&vb, b + (k * bn + j) * ld + p, sizeof(vb)); \
+					vc += va * vb; \
+				} \
+				memcpy(c + (i * bn + j) * ld + p, &vc, sizeof(vc)); \
+			} \
+		} \
+	} \
+	return p; \
+}
+
+#define MAT_BATCH_KERNS(_vt, _attr) \
+MAT_BATCH_KERN_N(mat_batch_3_ ## _vt, _vt, _attr, 3) \
+MAT_BATCH_KERN_N(mat_batch_4_ ## _vt, _vt, _attr, 4) \
+MAT_BATCH_KERN(mat_batch_ ## _vt, _vt, _attr)
+
+MAT_BATCH_KERNS(v4sf_t, )
+#if defined(__x86_64__) || defined(__i386__)
+MAT_BATCH_KERNS(v8sf_t, __attribute__((target("avx2,fma"))))
+MAT_BATCH_KERNS(v16sf_t, __attribute__((target("avx512f"))))
+#endif
+
+/* Kernels for 3 * 3, 4 * 4 and others, lanes for the remain products. */
+static const struct mat_batch_impl_rec {
+	mat_batch_kern_t kern[3];
+	int vl;
+} mat_batch_impl[] = {
+	{{&mat_batch_3_v4sf_t, &mat_batch_4_v4sf_t, &mat_batch_v4sf_t}, 4},
+#if defined(__x86_64__) || defined(__i386__)
+	{{&mat_batch_3_v8sf_t, &mat_batch_4_v8sf_t, &mat_batch_v8sf_t}, 8},
+	{{&mat_batch_3_v16sf_t, &mat_batch_4_v16sf_t, &mat_batch_v16sf_t}, 16},
+#endif
+};
+
+#define MAT_BATCH_VL_MAX 16
+#endif
+
+/* Batched products one by one, from product p. */
+static void mat_batch_sw(int am, int an, int bn, int p, int cnt,
+		const float *a, const float *b, float *c, int ld) {
+	int i, j, k;
+
+	for (; p < cnt; p++) {
+		for (i = 0; i < am; i++) {
+			for (j = 0; j < bn; j++) {
+				float cr = a[(i * an) * ld + p] * b[j * ld + p];
+
+				for (k = 1; k < an; k++) {
+					cr += a[(i * an + k) * ld + p] * b[(k * bn + j) * ld + p];
+				}
+				c[(i * bn + j) * ld + p] = cr;
+			}
+		}
+	}
+}
+
+/* Copy the remain products to lanes when the matrix not larger. */
+#define MAT_BATCH_TAIL_MAX 64
+
+void moss_matrix_mul_batch(int am, int an, int bn, int cnt, const float *a,
+		const float *b, float *c, int ld) {
+#ifdef __GNUC__
+	const struct mat_batch_impl_rec *impl = &mat_batch_impl[MOSS_MIN(
+			matrix_isa_get(), (int)MOSS_ARRAYSIZE(mat_batch_impl)) - 1];
+	mat_batch_kern_t kern = impl->kern[2];
+	int p, i, sz_a = am * an, sz_b = an * bn, sz_c = am * bn;
+	float ta[MAT_BATCH_TAIL_MAX * MAT_BATCH_VL_MAX];
+	float *tb = ta + sz_a * impl->vl, *tc = tb + sz_b * impl->vl;
+
+	if (am == an && an == bn && (am == 3 || am == 4)) {
+		kern = impl->kern[am - 3];
+	}
+	if ((p = (*kern)(am, an, bn, cnt, a, b, c, ld)) >= cnt) return;
+	if (sz_a + sz_b + sz_c > MAT_BATCH_TAIL_MAX) {
+		mat_batch_sw(am, an, bn, p, cnt, a, b, c, ld);
+		return;
+	}
+
+	// zero padded lanes, the same rounding to other products
+	memset(ta, 0, sizeof(float) * (sz_a + sz_b) * impl->vl);
+	for (i = 0; i < sz_a; i++) {
+		memcpy(ta + i * impl->vl, a + i * ld + p, sizeof(float) * (cnt - p));
+	}
+	for (i = 0; i < sz_b; i++) {
+		memcpy(tb + i * impl->vl, b + i * ld + p, sizeof(float) * (cnt - p));
+	}
+	(*kern)(am, an, bn, impl->vl, ta, tb, tc, impl->vl);
+	for (i = 0; i < sz_c; i++) {
+		memcpy(c + i * ld + p, tc + i * impl->vl, sizeof(float) * (cnt - p));
+	}
+#else
+	mat_batch_sw(am, an, bn, 0, cnt, a, b, c, ld);
+#endif
+}
+
+/* Q accumulator back to Q format, v >> sh with rounding and saturate. */
+#define q_shift_sat(_v, _sh, _flag, _min, _max) ((_v) = ((_flag) & \
+		moss_q_flag_round) ? q_add_sat(_v, (int64_t)1 << ((_sh) - 1)) : (_v), \
+		(_v) >>= (_sh), (_v) < (_min) ? (_min) : (_v) > (_max) ? (_max) : (_v))
+
+static inline int64_t q_add_sat(int64_t a, int64_t b) {
+	int64_t r;
+
+	if (__builtin_add_overflow(a, b, &r)) return a < 0 ? INT64_MIN : INT64_MAX;
+	return r;
+}
+
+void moss_matrix_mul_q15_sw(int am, int an, const int16_t *a, int bn,
+		const int16_t *b, int16_t *c, unsigned flag) {
+	int m, n, z;
+
+	for (m = 0; m < am; m++) {
+		for (n = 0; n < bn; n++) {
+			int64_t acc = 0;
+
+			for (z = 0; z < an; z++) acc += (int32_t)a[z] * b[z * bn + n];
+			*c++ = (int16_t)q_shift_sat(acc, 15, flag, INT16_MIN, INT16_MAX);
+		}
+		a += an;
+	}
+}
+
+#ifdef __GNUC__
+typedef int16_t q15_v4hi_t __attribute__((vector_size(sizeof(int16_t) * 4)));
+typedef int16_t q15_v8hi_t __attribute__((vector_size(sizeof(int16_t) * 8)));
+typedef int16_t q15_v16hi_t __attribute__((vector_size(sizeof(int16_t) * 16)));
+typedef int32_t q15_v2si_t __attribute__((vector_size(sizeof(int32_t) * 2)));
+typedef int32_t q15_v4si_t __attribute__((vector_size(sizeof(int32_t) * 4)));
+typedef int32_t q15_v8si_t __attribute__((vector_size(sizeof(int32_t) * 8)));
+typedef int32_t q15_v16si_t __attribute__((vector_size(sizeof(int32_t) * 16)));
+typedef int64_t q15_v2di_t __attribute__((vector_size(sizeof(int64_t) * 2)));
+typedef int64_t q15_v4di_t __attribute__((vector_size(sizeof(int64_t) * 4)));
+typedef int64_t q15_v8di_t __attribute__((vector_size(sizeof(int64_t) * 8)));
+
+/* Row of Q15 matrix multiply, columns in lanes of native width vector, the
+ * product widen to 64 bits in 2 halves, return count of column done.
+ */
+#define Q15_KERN(_name, _attr, _hv, _sv, _shv, _dv) \
+static _attr int _name(int an, const int16_t *a, int bn, const int16_t *b, \
+		int16_t *c, unsigned flag) { \
+	enum { vl = sizeof(_hv) / sizeof(int16_t) }; \
+	int64_t rnd = (flag & moss_q_flag_round) ? ((int64_t)1 << 14) : 0, v; \
+	_dv acc[2]; \
+	_shv half; \
+	_sv prod; \
+	_hv vb; \
+	int n, z, i; \
+\
+	for (n = 0; n + vl <= bn; n += vl) { \
+		memset(acc, 0, sizeof(acc)); \
+		for (z = 0; z < an; z++) { \
+			memcpy(&vb, b + z * bn + n, sizeof(vb)); \
+			prod = __builtin_convertvector(vb, _sv) * (int32_t)a[z]; \
+			memcpy(&half, &prod, sizeof(half)); \
+			acc[0] += __builtin_convertvector(half, _dv); \
+			memcpy(&half, (char*)&prod + sizeof(half), sizeof(half)); \
+			acc[1] += __builtin_convertvector(half, _dv); \
+		} \
+		/* the sum of Q30 not reach 64 bits overflow, no saturate for add */ \
+		for (i = 0; i < vl; i++) { \
+			v = (acc[i / (vl / 2)][i % (vl / 2)] + rnd) >> 15; \
+			c[n + i] = v < INT16_MIN ? INT16_MIN : v > INT16_MAX ? INT16_MAX : v; \
+		} \
+	} \
+	return n; \
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/* SSE2 lack of sign extension and 32 bits multiply. */
+Q15_KERN(q15_kern_v4, __attribute__((target("sse4.1"))), q15_v4hi_t,
+		q15_v4si_t, q15_v2si_t, q15_v2di_t)
+Q15_KERN(q15_kern_v8, __attribute__((target("avx2"))), q15_v8hi_t,
+		q15_v8si_t, q15_v4si_t, q15_v4di_t)
+Q15_KERN(q15_kern_v16, __attribute__((target("avx512f"))), q15_v16hi_t,
+		q15_v16si_t, q15_v8si_t, q15_v8di_t)
+#else
+Q15_KERN(q15_kern_v4, , q15_v4hi_t, q15_v4si_t, q15_v2si_t, q15_v2di_t)
+#endif
+#endif
+
+void moss_matrix_mul_q15(int am, int an, const int16_t *a, int bn,
+		const int16_t *b, int16_t *c, unsigned flag) {
+#ifdef __GNUC__
+	int (*kern)(int, const int16_t*, int, const int16_t*, int16_t*,
+			unsigned) = &q15_kern_v4;
+	int m, n, z;
+
+#if defined(__x86_64__) || defined(__i386__)
+	switch (matrix_isa_get()) {
+	case matrix_isa_v16sf:
+		kern = &q15_kern_v16;
+		break;
+	case matrix_isa_v8sf:
+		kern = &q15_kern_v8;
+		break;
+	default:
+		if (!__builtin_cpu_supports("sse4.1")) kern = NULL;
+		break;
+	}
+#endif
+	for (m = 0; m < am; m++) {
+		n = kern ? (*kern)(an, a, bn, b, c, flag) : 0;
+		for (; n < bn; n++) {
+			int64_t sum = 0;
+
+			for (z = 0; z < an; z++) sum += (int32_t)a[z] * b[z * bn + n];
+			c[n] = (int16_t)q_shift_sat(sum, 15, flag, INT16_MIN, INT16_MAX);
+		}
+		a += an;
+		c += bn;
+	}
+#else
+	moss_matrix_mul_q15_sw(am, an, a, bn, b, c, flag);
+#endif
+}
+
+void moss_matrix_mul_q31(int am, int an, const int32_t *a, int bn,
+		const int32_t *b, int32_t *c, unsigned flag) {
+	int m, n, z;
+
+	for (m = 0; m < am; m++) {
+		for (n = 0; n < bn; n++) {
+			int64_t acc = 0;
+
+			for (z = 0; z < an; z++) {
+				acc = q_add_sat(acc, (int64_t)a[z] * b[z * bn + n]);
+			}
+			*c++ = (int32_t)q_shift_sat(acc, 31, flag, INT32_MIN, INT32_MAX);
+		}
+		a += an;
+	}
+}
+
+void moss_q15_from_float(int16_t *q, const float *f, size_t cnt) {
+	float v;
+
+	while (cnt-- > 0) {
+		v = *f++ * 32768.0f;
+		// add half in double, exact for float, not round up just below half
+		*q++ = !(v == v) ? 0 : v >= 32767.0f ? INT16_MAX :
+				v <= -32768.0f ? INT16_MIN :
+				(int16_t)(v >= 0.0f ? v + 0.5 : v - 0.5);
+	}
+}
+
+void moss_q15_to_float(float *f, const int16_t *q, size_t cnt) {
+	while (cnt-- > 0) *f++ = *q++ * (1.0f / 32768.0f);
+}
+
+void moss_q31_from_float(int32_t *q, const float *f, size_t cnt) {
+	double v;
+
+	while (cnt-- > 0) {
+		v = *f++ * 2147483648.0;
+		*q++ = !(v == v) ? 0 : v >= 2147483647.0 ? INT32_MAX :
+				v <= -2147483648.0 ? INT32_MIN :
+				(int32_t)(v >= 0.0 ? v + 0.5 : v - 0.5);
+	}
+}
+
+void moss_q31_to_float(float *f, const int32_t *q, size_t cnt) {
+	while (cnt-- > 0) *f++ = (float)(*q++ * (1.0 / 2147483648.0));
+}
+
+void moss_matrix_mul_ld(int am, int an, const float *a, int lda, int bn,
+		const float *b, int ldb, float *c, int ldc) {
+#ifdef __GNUC__
+	// not go moss_sgemv() for single column, keep the same result on split
+	sgemm_blocked(am, bn, an, 1.0f, a, lda, 1, b, ldb, 1, c, ldc, 1);
+#else
+	moss_sgemm(0, 0, am, bn, an, 1.0f, a, lda, b, ldb, 0.0f, c, ldc);
+#endif
+}
+
+void moss_sgemm(int ta, int tb, int m, int n, int k, float alpha,
+		const float *a, int lda, const float *b, int ldb, float beta,
+		float *c, int ldc) {
+	int i, j;
+
+	if (m <= 0 || n <= 0) return;
+	if (n == 1 && alpha != 0.0f) {
+		// column vector of op(b)
+		if (ta) {
+			moss_sgemv(1, k, m, alpha, a, lda, b, tb ? 1 : ldb, beta, c, ldc);
+		} else {
+			moss_sgemv(0, m, k, alpha, a, lda, b, tb ? 1 : ldb, beta, c, ldc);
+		}
 		return;
 	}
+	// beta applied before accumulate, ignore c when 0
+	if (beta != 1.0f && beta != 0.0f) {
+		for (i = 0; i < m; i++) {
+			for (j = 0; j < n; j++) c[i * ldc + j] *= beta;
+		}
+	}
+	if (alpha == 0.0f || k <= 0) {
+		for (i = 0; beta == 0.0f && i < m; i++) {
+			memset(c + i * ldc, 0, sizeof(float) * n);
+		}
+		return;
+	}
+#ifdef __GNUC__
+	sgemm_blocked(m, n, k, alpha, a, ta ? 1 : lda, ta ? lda : 1,
+			b, tb ? 1 : ldb, tb ? ldb : 1, c, ldc, beta == 0.0f);
+#else
+	{
+		int a_rs = ta ? 1 : lda, a_cs = ta ? lda : 1;
+		int b_rs = tb ? 1 : ldb, b_cs = tb ? ldb : 1, z;
+
+		for (i = 0; i < m; i++) {
+			for (j = 0; j < n; j++) {
+				register float cr = beta == 0.0f ? 0.0f : c[i * ldc + j];
+
+				for (z = 0; z < k; z++) {
+					cr += alpha * a[i * a_rs + z * a_cs] * b[z * b_rs + j * b_cs];
+				}
+				c[i * ldc + j] = cr;
+			}
+		}
+	}
+#endif
+}
+
+void moss_sgemv(int ta, int m, int n, float alpha, const float *a, int lda,
+		const float *x, int incx, float beta, float *y, int incy) {
+	int i, j, ylen = ta ? n : m;
+
+	if (ylen <= 0) return;
+	for (i = 0; i < ylen; i++) {
+		y[i * incy] = beta == 0.0f ? 0.0f : y[i * incy] * beta;
+	}
+	if (alpha == 0.0f) return;
+
+	if (ta) {
+		// y += alpha * x[i] * a[i][], the row contiguous
+		for (i = 0; i < m; i++) {
+			const float *ar = a + i * lda;
+			float ax = alpha * x[i * incx];
+
+			if (incy == 1) {
+				for (j = 0; j < n; j++) y[j] += ax * ar[j];
+			} else {
+				for (j = 0; j < n; j++) y[j * incy] += ax * ar[j];
+			}
+		}
+		return;
+	}
+
+	// dot product of row to x
+	for (i = 0; i < m; i++) {
+		const float *ar = a + i * lda;
+		float dot = 0.0f;
+
+		j = 0;
+#ifdef __GNUC__
+		if (incx == 1 && n >= 8) {
+			v4sf_t acc0 = {0}, acc1 = {0}, va, vx;
+
+			for (; j + 8 <= n; j += 8) {
+				memcpy(&va, ar + j, sizeof(va));
+				memcpy(&vx, x + j, sizeof(vx));
+				acc0 += va * vx;
+				memcpy(&va, ar + j + 4, sizeof(va));
+				memcpy(&vx, x + j + 4, sizeof(vx));
+				acc1 += va * vx;
+			}
+			acc0 += acc1;
+			dot = (acc0[0] + acc0[1]) + (acc0[2] + acc0[3]);
+		}
 #endif
-	moss_matrix_mul_sw(am, an, a, bn, b, c);
+		for (; j < n; j++) dot += ar[j] * x[j * incx];
+		y[i * incy] += alpha * dot;
+	}
 }
 
 void moss_int2hexstr(void *_buf, unsigned val, int width, int cap) {
@@ -3,6 +3,234 @@
 #ifndef _H_MOSS_IMPL_SYS
 #define _H_MOSS_IMPL_SYS
 
+#ifndef _H_MOSS_HAL_SYS
+#  error "Please #include <moss/hal/sys.h> instead."
+#endif
 
+#include <sys/types.h>
+#include <moss/moss.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @addtogroup MOSS_BUF
+ * @{
+ */
+
+/** Fill moss buffer from file descriptor.
+ *
+ * Single readv() to the free space on both side of the end of data memory.
+ * Interrupted call is restarted.
+ *
+ * @param buf
+ * @param fd
+ * @return Bytes appended, 0 for end of file, -1 for error with errno set,
+ *   EAGAIN/EWOULDBLOCK for non-blocking fd not ready, ENOBUFS for buffer
+ *   full.
+ */
+ssize_t moss_buf_read_fd(moss_buf_t *buf, int fd);
+
+/** Drain moss buffer to file descriptor.
+ *
+ * Single writev() from the valid data on both side of the end of data
+ * memory.  Interrupted call is restarted.
+ *
+ * @param buf
+ * @param fd
+ * @return Bytes dropped from the buffer, 0 for empty buffer, -1 for error
+ *   with errno set, EAGAIN/EWOULDBLOCK for non-blocking fd not ready.
+ */
+ssize_t moss_buf_write_fd(moss_buf_t *buf, int fd);
+
+/** Drain moss buffer chain to file descriptor.
+ *
+ * Single writev() from the valid data of all segments, up to IOV_MAX
+ * segments.  Interrupted call is restarted.
+ *
+ * @param chain
+ * @param fd
+ * @return Bytes dropped from the chain, 0 for empty chain, -1 for error
+ *   with errno set, EAGAIN/EWOULDBLOCK for non-blocking fd not ready.
+ */
+ssize_t moss_buf_chain_write_fd(moss_buf_chain_t *chain, int fd);
+
+/** Allocate mirrored data memory for moss buffer.
+ *
+ * Map the same memfd pages twice back to back and set moss_buf_flag_mirror,
+ * so read, write and printf never split at the end of data memory.  The
+ * capable rounds up to page size.  Release with moss_buf_mirror_free().
+ *
+ * @param buf
+ * @param cap
+ * @return 0 when success, others when failure.
+ */
+int moss_buf_mirror_alloc(moss_buf_t *buf, size_t cap);
+
+/** Release data memory from moss_buf_mirror_alloc(). */
+void moss_buf_mirror_free(moss_buf_t *buf);
+
+/** Start worker thread as asynchronous copy engine.
+ *
+ * Stand-in for DMA controller, copies complete in submission order.
+ *
+ * @param engine
+ * @return 0 when success, others when failure.
+ */
+int moss_copy_engine_thread_open(moss_copy_engine_t *engine);
+
+/** Complete queued copies and stop the worker thread. */
+void moss_copy_engine_thread_close(moss_copy_engine_t *engine);
+
+/** @} MOSS_BUF */
+
+/** @addtogroup MOSS_LOG
+ * @{
+ */
+
+/** Flags for asynchronous message log. */
+typedef enum moss_log_async_flag_enum {
+	/** Wait for free slot when queue full, otherwise drop the message. */
+	moss_log_async_flag_block = (1 << 0),
+} moss_log_async_flag_t;
+
+/** Start asynchronous message log.
+ *
+ * Message log formatted to lock-free queue on the caller thread, and
+ * written to stdout with batched writev() from background thread.  Call
+ * before and after other thread start/stop to log.  Message log bypass
+ * stdio, stdout flushed once at the start and the first synchronous
+ * write(), later application printf() not ordered with message log, fflush()
+ * and moss_log_flush() when matter.
+ *
+ * @param slots Count of message in queue, round up to power of 2.
+ * @param flag moss_log_async_flag_t
+ * @return 0 when success, others when failure.
+ */
+int moss_log_async_start(size_t slots, unsigned flag);
+
+/** Flush and stop asynchronous message log. */
+void moss_log_async_stop(void);
+
+/** Count of message dropped due to queue full. */
+unsigned long moss_log_async_dropped(void);
+
+/** Open file sink for message log.
+ *
+ * Lines coalesced in memory and written by background thread when buffered
+ * reach flush_sz or after flush_ms.  The file opened with O_APPEND, renamed
+ * to path.1 and reopened when size reach rotate_sz, writers keep filling the
+ * other memory meanwhile.  Writers wait only when both memory full.
+ *
+ * Example:
+ * @code{.c}
+ * moss_log_sink_t *sink = moss_log_sink_file_open("app.log", 256 * 1024,
+ *         0, 0, 16 * 1024 * 1024);
+ *
+ * moss_log_sink_set(sink);
+ * ...
+ * moss_log_flush();
+ * moss_log_sink_set(NULL);
+ * moss_log_sink_file_close(sink);
+ * @endcode
+ *
+ * @param path
+ * @param buf_sz Size for each of the double memory.
+ * @param flush_sz Write out buffered reach the size, 0 for half of buf_sz.
+ * @param flush_ms Write out buffered after the time, 0 for 1 second.
+ * @param rotate_sz Rotate file reach the size, 0 to disable.
+ * @return The sink, NULL when failure.
+ */
+moss_log_sink_t *moss_log_sink_file_open(const char *path, size_t buf_sz,
+		size_t flush_sz, unsigned flush_ms, size_t rotate_sz);
+
+/** Count of lines dropped due to file write failure. */
+unsigned long moss_log_sink_file_dropped(moss_log_sink_t *sink);
+
+/** Write out buffered and close file sink. */
+void moss_log_sink_file_close(moss_log_sink_t *sink);
+
+/** Open flight recorder sink for message log.
+ *
+ * Lines kept as records (moss_buf_msg_push()) in ring of memory mapped file,
+ * the oldest dropped when full.  Cost only memory copy, the page cache keep
+ * the recent lines even the process crashed or killed.  Continue the ring
+ * when the file has the same size.
+ *
+ * @param path
+ * @param cap Size of the ring, round up to page size.
+ * @return The sink, NULL when failure.
+ */
+moss_log_sink_t *moss_log_sink_mmap_open(const char *path, size_t cap);
+
+/** Close flight recorder sink. */
+void moss_log_sink_mmap_close(moss_log_sink_t *sink);
+
+/** Write the lines in flight recorder file, the oldest first.
+ *
+ * @param path
+ * @param fd Output, ie. STDOUT_FILENO.
+ * @return 0 when success, others when failure.
+ */
+int moss_log_sink_mmap_recover(const char *path, int fd);
+
+/** Clock source for message log timestamp. */
+typedef enum moss_log_clock_enum {
+	/** CLOCK_REALTIME. */
+	moss_log_clock_realtime = 0,
+	/** CLOCK_REALTIME_COARSE, cheaper but tick resolution. */
+	moss_log_clock_coarse,
+	/** CLOCK_MONOTONIC with realtime offset taken when set, not follow
+	 * the wall clock adjustment. */
+	moss_log_clock_monotonic,
+} moss_log_clock_t;
+
+/** Select clock source for moss_log_ts().
+ *
+ * Call before other thread start to log.
+ *
+ * @param clk moss_log_clock_t
+ * @return 0 when success, others when failure.
+ */
+int moss_log_clock_set(int clk);
+
+/** @} MOSS_LOG */
+
+/** @addtogroup MOSS_MISC
+ * @{
+ */
+
+/** Below the size (am * an * bn) moss_matrix_mul_mt() stay on the caller. */
+#ifndef MOSS_MATRIX_MUL_MT_MIN
+#define MOSS_MATRIX_MUL_MT_MIN (96 * 96 * 96)
+#endif
+
+/** Start worker threads for moss_matrix_mul_mt().
+ *
+ * @param cnt Count of worker thread, 0 for online cpu minus 1 (the caller
+ *   also compute).
+ * @return 0 when success, others when failure.
+ */
+int moss_matrix_pool_open(int cnt);
+
+/** Stop worker threads for moss_matrix_mul_mt(). */
+void moss_matrix_pool_close(void);
+
+/** Matrix multiply on worker threads.
+ *
+ * Split **c** to tiles of rows and columns, the caller and worker threads
+ * take the tile in order.  Result bitwise identical to moss_matrix_mul().
+ * Start the worker threads at the first call when not yet, stay on the
+ * caller when no worker (ie. single cpu).
+ *
+ * Reference to moss_matrix_mul_sw() for the parameters.
+ */
+void moss_matrix_mul_mt(int am, int an, float *a, int bn, float *b, float *c);
+
+/** @} MOSS_MISC */
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
 
 #endif /* _H_MOSS_IMPL_SYS */
@@ -1,27 +1,828 @@
+#ifndef _GNU_SOURCE
+#  define _GNU_SOURCE
+#endif
+
 #include <unistd.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <time.h>
+#include <pthread.h>
+#include <sched.h>
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
 
 #include <moss/moss.h>
+#include <moss/hal/sys.h>
 
 const char *moss_newline = "\n";
 
-static char _log_buf[256];
-static moss_buf_t log_buf = {.data = _log_buf, .cap = sizeof(_log_buf)};
+/* Format message log on thread local memory. */
+static __thread char log_mem[MOSS_LOG_LINE_MAX];
 
-int moss_vlog(unsigned lvl, const char *tag, long lno,
+/* Set after stdout flushed for the first raw write. */
+static int log_stdout_raw = 0;
+
+/* Write all or fail, bypass stdio so flush stdout once at the first raw
+ * write to stdout, not lock stdio for each line.  Bytes written to done
+ * when not NULL.
+ */
+static int log_write(int fd, const void *data, size_t sz, size_t *done) {
+	ssize_t r;
+
+	if (fd == STDOUT_FILENO && !__atomic_load_n(&log_stdout_raw,
+			__ATOMIC_RELAXED)) {
+		fflush(stdout);
+		__atomic_store_n(&log_stdout_raw, 1, __ATOMIC_RELAXED);
+	}
+	if (done) *done = 0;
+	while (sz > 0) {
+		if ((r = write(fd, data, sz)) < 0) {
+			if (errno == EINTR) continue;
+			return -1;
+		}
+		data = (char*)data + r;
+		sz -= r;
+		if (done) *done += r;
+	}
+	return 0;
+}
+
+/* Slot of asynchronous log queue, seq tells the owner.
+ *
+ * - seq == index: free for producer claim the index.
+ * - seq == index + 1: formatted for consumer.
+ */
+typedef struct log_slot_rec {
+	size_t seq, len;
+	char *ext; /**< Expanded memory for long message. */
+	char line[MOSS_LOG_LINE_MAX];
+} log_slot_t;
+
+/* Bounded multiple producer single consumer queue. */
+static struct {
+	log_slot_t *slots;
+	size_t mask;
+	unsigned flag;
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond, flushed;
+	int quit, flush_wait;
+	unsigned long dropped;
+
+	/* Claimed by producers. */
+	size_t enq __attribute__((aligned(MOSS_CACHELINE_SIZE)));
+
+	/* Released by consumer. */
+	size_t deq __attribute__((aligned(MOSS_CACHELINE_SIZE)));
+	int idle;
+} log_async = {
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+	.flushed = PTHREAD_COND_INITIALIZER,
+};
+
+#define LOG_ASYNC_IOV_MAX 64
+
+static void *log_async_run(void *arg) {
+	struct iovec iov[LOG_ASYNC_IOV_MAX];
+	size_t deq = log_async.deq, idx;
+	log_slot_t *slot;
+	int iov_cnt, quit;
+	struct timespec ts;
+
+	(void)arg;
+	while (1) {
+		for (iov_cnt = 0, idx = deq; iov_cnt < LOG_ASYNC_IOV_MAX; idx++) {
+			slot = &log_async.slots[idx & log_async.mask];
+			if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != idx + 1) break;
+			iov[iov_cnt].iov_base = slot->ext ? slot->ext : slot->line;
+			iov[iov_cnt++].iov_len = slot->len;
+		}
+		if (iov_cnt > 0) {
+			struct iovec *iov_pos = iov;
+			int iov_left = iov_cnt;
+			ssize_t r;
+
+			moss_log_sink_t *sink = moss_log_sink_get();
+
+			// complete the batch or give up on error
+			if (sink) {
+				(*sink->write)(sink, (moss_iov_t*)iov, iov_cnt);
+				iov_left = 0;
+			}
+			while (iov_left > 0) {
+				if ((r = writev(STDOUT_FILENO, iov_pos, iov_left)) < 0) {
+					if (errno == EINTR) continue;
+					break;
+				}
+				while (iov_left > 0 && (size_t)r >= iov_pos->iov_len) {
+					r -= iov_pos->iov_len;
+					iov_pos++;
+					iov_left--;
+				}
+				if (iov_left > 0) {
+					iov_pos->iov_base = (char*)iov_pos->iov_base + r;
+					iov_pos->iov_len -= r;
+				}
+			}
+			for (; deq < idx; deq++) {
+				slot = &log_async.slots[deq & log_async.mask];
+				if (slot->ext) {
+					free(slot->ext);
+					slot->ext = NULL;
+				}
+				__atomic_store_n(&slot->seq, deq + log_async.mask + 1,
+						__ATOMIC_RELEASE);
+			}
+			__atomic_store_n(&log_async.deq, deq, __ATOMIC_RELEASE);
+			if (__atomic_load_n(&log_async.flush_wait, __ATOMIC_ACQUIRE)) {
+				pthread_mutex_lock(&log_async.mutex);
+				pthread_cond_broadcast(&log_async.flushed);
+				pthread_mutex_unlock(&log_async.mutex);
+			}
+			continue;
+		}
+
+		// idle until producer or timeout
+		pthread_mutex_lock(&log_async.mutex);
+		__atomic_store_n(&log_async.idle, 1, __ATOMIC_SEQ_CST);
+		slot = &log_async.slots[deq & log_async.mask];
+		if (!(quit = log_async.quit) && __atomic_load_n(&slot->seq,
+				__ATOMIC_SEQ_CST) != deq + 1) {
+			clock_gettime(CLOCK_REALTIME, &ts);
+			if ((ts.tv_nsec += 100000000) >= 1000000000) {
+				ts.tv_sec++;
+				ts.tv_nsec -= 1000000000;
+			}
+			pthread_cond_timedwait(&log_async.cond, &log_async.mutex, &ts);
+		}
+		__atomic_store_n(&log_async.idle, 0, __ATOMIC_RELAXED);
+		pthread_mutex_unlock(&log_async.mutex);
+		if (quit) break;
+	}
+	return NULL;
+}
+
+/* Claim slot for producer, NULL when queue full and drop. */
+static log_slot_t *log_async_claim(size_t *enq_claim) {
+	size_t enq = __atomic_load_n(&log_async.enq, __ATOMIC_RELAXED);
+	log_slot_t *slot;
+	long dif;
+
+	while (1) {
+		slot = &log_async.slots[enq & log_async.mask];
+		dif = (long)(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - enq);
+		if (dif == 0) {
+			if (__atomic_compare_exchange_n(&log_async.enq, &enq, enq + 1, 1,
+					__ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+				break;
+			}
+			continue;
+		}
+		if (dif < 0) {
+			// queue full
+			if (!(log_async.flag & moss_log_async_flag_block)) {
+				__atomic_fetch_add(&log_async.dropped, 1, __ATOMIC_RELAXED);
+				return NULL;
+			}
+			sched_yield();
+		}
+		enq = __atomic_load_n(&log_async.enq, __ATOMIC_RELAXED);
+	}
+	*enq_claim = enq;
+	return slot;
+}
+
+/* Hand over the slot to consumer. */
+static void log_async_publish(log_slot_t *slot, size_t enq) {
+	__atomic_store_n(&slot->seq, enq + 1, __ATOMIC_SEQ_CST);
+
+	if (__atomic_load_n(&log_async.idle, __ATOMIC_SEQ_CST)) {
+		pthread_mutex_lock(&log_async.mutex);
+		pthread_cond_signal(&log_async.cond);
+		pthread_mutex_unlock(&log_async.mutex);
+	}
+}
+
+static int log_async_vlog(unsigned lvl, const char *tag, long lno,
+		const char *fmt, va_list va) {
+	moss_buf_t buf = {.cap = MOSS_LOG_LINE_MAX};
+	log_slot_t *slot;
+	size_t enq;
+	int r;
+
+	if (!(slot = log_async_claim(&enq))) return -1;
+	buf.data = slot->line;
+	r = moss_vlogf_expand(&buf, MOSS_LOG_LINE_EXPAND_MAX, lvl, tag, lno,
+			fmt, va);
+	if (buf.data != slot->line) slot->ext = (char*)buf.data;
+	slot->len = buf.lmt;
+	log_async_publish(slot, enq);
+	return r;
+}
+
+static int log_async_write(const void *data, size_t sz) {
+	log_slot_t *slot;
+	size_t enq;
+	int r = 0;
+
+	if (!(slot = log_async_claim(&enq))) return -1;
+	if (sz <= sizeof(slot->line)) {
+		memcpy(slot->line, data, sz);
+	} else if ((slot->ext = (char*)malloc(sz))) {
+		memcpy(slot->ext, data, sz);
+	} else {
+		sz = 0;
+		r = -1;
+	}
+	slot->len = sz;
+	log_async_publish(slot, enq);
+	return r;
+}
+
+int moss_log_async_start(size_t slots, unsigned flag) {
+	size_t cnt, i;
+	int r;
+
+	if (log_async.slots) return 0;
+	for (cnt = 2; cnt < slots; cnt <<= 1);
+	if (!(log_async.slots = (log_slot_t*)malloc(sizeof(log_slot_t) * cnt))) {
+		moss_error("Failed alloc log queue\n");
+		return -1;
+	}
+	for (i = 0; i < cnt; i++) {
+		log_async.slots[i].seq = i;
+		log_async.slots[i].ext = NULL;
+	}
+	log_async.mask = cnt - 1;
+	log_async.flag = flag;
+	log_async.enq = log_async.deq = 0;
+	log_async.quit = 0;
+	fflush(stdout);
+	if ((r = pthread_create(&log_async.thread, NULL, &log_async_run,
+			NULL)) != 0) {
+		free(log_async.slots);
+		log_async.slots = NULL;
+		moss_error("Failed start log thread: %s(%d)\n", strerror(r), r);
+		return -1;
+	}
+	return 0;
+}
+
+void moss_log_async_stop(void) {
+	log_slot_t *slots;
+
+	if (!(slots = log_async.slots)) return;
+	moss_log_flush();
+	pthread_mutex_lock(&log_async.mutex);
+	log_async.quit = 1;
+	pthread_cond_signal(&log_async.cond);
+	pthread_mutex_unlock(&log_async.mutex);
+	pthread_join(log_async.thread, NULL);
+	log_async.slots = NULL;
+	free(slots);
+}
+
+unsigned long moss_log_async_dropped(void) {
+	return __atomic_load_n(&log_async.dropped, __ATOMIC_RELAXED);
+}
+
+static int log_sink_flush(void) {
+	moss_log_sink_t *sink = moss_log_sink_get();
+
+	if (!sink) return fflush(stdout);
+	return sink->flush ? (*sink->flush)(sink) : 0;
+}
+
+int moss_log_flush(void) {
+	size_t enq;
+
+	if (!log_async.slots) return log_sink_flush();
+	enq = __atomic_load_n(&log_async.enq, __ATOMIC_ACQUIRE);
+	pthread_mutex_lock(&log_async.mutex);
+	__atomic_fetch_add(&log_async.flush_wait, 1, __ATOMIC_RELEASE);
+	pthread_cond_signal(&log_async.cond);
+	while ((long)(__atomic_load_n(&log_async.deq, __ATOMIC_ACQUIRE) - enq) < 0) {
+		pthread_cond_wait(&log_async.flushed, &log_async.mutex);
+	}
+	__atomic_fetch_sub(&log_async.flush_wait, 1, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&log_async.mutex);
+	return log_sink_flush();
+}
+
+static int log_vlog(unsigned lvl, const char *tag, long lno,
 		const char *fmt, va_list va) {
+	moss_buf_t buf = {.data = log_mem, .cap = sizeof(log_mem)};
+	moss_log_sink_t *sink;
+	int r;
+
+	if (log_async.slots) return log_async_vlog(lvl, tag, lno, fmt, va);
+	r = moss_vlogf_expand(&buf, MOSS_LOG_LINE_EXPAND_MAX, lvl, tag, lno,
+			fmt, va);
+	if (buf.lmt <= 0) {
+		;
+	} else if ((sink = moss_log_sink_get())) {
+		moss_iov_t iov = {.iov_base = buf.data, .iov_len = buf.lmt};
+
+		(*sink->write)(sink, &iov, 1);
+	} else {
+		// single write for the line not interleave with other thread
+		log_write(STDOUT_FILENO, buf.data, buf.lmt, NULL);
+	}
+	if (buf.data != log_mem) free(buf.data);
+	return r;
+}
+
+/* File sink, writers fill the active memory and the worker thread write the
+ * other memory to file, rename and reopen file also on the worker thread.
+ */
+typedef struct log_sink_file_rec {
+	moss_log_sink_t sink;
+	char *path;
+	int fd;
+	size_t cap, flush_sz, rotate_sz, file_sz;
+	unsigned flush_ms;
+	char *mem[2];
+	size_t lmt; /**< Filled in mem[0]. */
+	unsigned long flush_req, flush_done;
+	int space_wait; /**< Count of writer wait for space. */
+	unsigned long dropped; /**< Lines failed to write. */
+	int quit;
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond, space, done;
+} log_sink_file_t;
+
+static int log_sink_file_rotate(log_sink_file_t *file) {
+	char path[PATH_MAX];
+	int fd, r;
+
+	snprintf(path, sizeof(path), "%s.1", file->path);
+	if (rename(file->path, path) != 0) {
+		r = errno;
+		fprintf(stderr, "Failed rename %s: %s(%d)\n", file->path,
+				strerror(r), r);
+		return -1;
+	}
+	if ((fd = open(file->path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC,
+			0644)) == -1) {
+		r = errno;
+		fprintf(stderr, "Failed open %s: %s(%d)\n", file->path,
+				strerror(r), r);
+		return -1;
+	}
+	close(file->fd);
+	file->fd = fd;
+	file->file_sz = 0;
+	return 0;
+}
+
+/* Count of lines, the partial line counted. */
+static unsigned long log_line_cnt(const char *data, size_t sz) {
+	const char *end = data + sz, *nl;
+	unsigned long cnt = 0;
+
+	for (; data < end; data = nl + 1, cnt++) {
+		if (!(nl = (const char*)memchr(data, '\n', end - data))) nl = end - 1;
+	}
+	return cnt;
+}
+
+static void *log_sink_file_run(void *arg) {
+	log_sink_file_t *file = (log_sink_file_t*)arg;
+	unsigned long req;
+	struct timespec ts;
+	char *mem;
+	size_t sz;
+
+	pthread_mutex_lock(&file->mutex);
+	while (1) {
+		if (file->lmt < file->flush_sz && file->flush_req == file->flush_done
+				&& file->space_wait <= 0 && !file->quit) {
+			clock_gettime(CLOCK_REALTIME, &ts);
+			ts.tv_sec += file->flush_ms / 1000;
+			if ((ts.tv_nsec += (file->flush_ms % 1000) * 1000000)
+					>= 1000000000) {
+				ts.tv_sec++;
+				ts.tv_nsec -= 1000000000;
+			}
+			// wake for size threshold, flush request, writer wait for space
+			// or time threshold
+			if (pthread_cond_timedwait(&file->cond, &file->mutex, &ts) == 0
+					|| file->lmt <= 0) {
+				continue;
+			}
+		}
+		if (file->lmt <= 0 && file->quit) break;
+
+		// swap memory then writers go on
+		mem = file->mem[0];
+		sz = file->lmt;
+		file->mem[0] = file->mem[1];
+		file->mem[1] = mem;
+		file->lmt = 0;
+		req = file->flush_req;
+		pthread_cond_broadcast(&file->space);
+		pthread_mutex_unlock(&file->mutex);
+
+		if (sz > 0) {
+			size_t done;
+
+			if (log_write(file->fd, mem, sz, &done) != 0) {
+				__atomic_fetch_add(&file->dropped,
+						log_line_cnt(mem + done, sz - done), __ATOMIC_RELAXED);
+			}
+			// rotate by the size on file
+			file->file_sz += done;
+			if (file->rotate_sz > 0 && file->file_sz >= file->rotate_sz) {
+				log_sink_file_rotate(file);
+			}
+		}
+
+		pthread_mutex_lock(&file->mutex);
+		file->flush_done = req;
+		pthread_cond_broadcast(&file->done);
+	}
+	pthread_mutex_unlock(&file->mutex);
+	return NULL;
+}
+
+static int log_sink_file_write(moss_log_sink_t *sink, const moss_iov_t *iov,
+		int cnt) {
+	log_sink_file_t *file = (log_sink_file_t*)sink->priv;
+	const char *data;
+	size_t sz, len;
+	int i;
+
+	pthread_mutex_lock(&file->mutex);
+	for (i = 0; i < cnt; i++) {
+		data = (const char*)iov[i].iov_base;
+		sz = iov[i].iov_len;
+		// split only the line larger than the memory
+		while (sz > 0) {
+			if (file->lmt >= file->cap
+					|| (sz <= file->cap && file->cap - file->lmt < sz)) {
+				// both memory in use, wait for the worker thread, which swap
+				// right after the write in progress
+				file->space_wait++;
+				pthread_cond_signal(&file->cond);
+				pthread_cond_wait(&file->space, &file->mutex);
+				file->space_wait--;
+				continue;
+			}
+			if ((len = file->cap - file->lmt) > sz) len = sz;
+			memcpy(file->mem[0] + file->lmt, data, len);
+			file->lmt += len;
+			data += len;
+			sz -= len;
+		}
+	}
+	if (file->lmt >= file->flush_sz) pthread_cond_signal(&file->cond);
+	pthread_mutex_unlock(&file->mutex);
+	return 0;
+}
+
+static int log_sink_file_flush(moss_log_sink_t *sink) {
+	log_sink_file_t *file = (log_sink_file_t*)sink->priv;
+	unsigned long req;
+
+	pthread_mutex_lock(&file->mutex);
+	req = ++file->flush_req;
+	pthread_cond_signal(&file->cond);
+	while ((long)(file->flush_done - req) < 0) {
+		pthread_cond_wait(&file->done, &file->mutex);
+	}
+	pthread_mutex_unlock(&file->mutex);
+	return 0;
+}
+
+moss_log_sink_t *moss_log_sink_file_open(const char *path, size_t buf_sz,
+		size_t flush_sz, unsigned flush_ms, size_t rotate_sz) {
+	log_sink_file_t *file;
+	struct stat st;
+	int r;
+
+	if (buf_sz < 4096) buf_sz = 4096;
+	if (flush_sz <= 0 || flush_sz > buf_sz) flush_sz = buf_sz / 2;
+	if (flush_ms <= 0) flush_ms = 1000;
+
+	if (!(file = (log_sink_file_t*)calloc(1, sizeof(*file) + buf_sz * 2
+			+ strlen(path) + 1))) {
+		r = errno;
+		moss_error("Failed alloc file sink: %s(%d)\n", strerror(r), r);
+		return NULL;
+	}
+	file->mem[0] = (char*)(file + 1);
+	file->mem[1] = file->mem[0] + buf_sz;
+	file->path = file->mem[1] + buf_sz;
+	strcpy(file->path, path);
+	file->cap = buf_sz;
+	file->flush_sz = flush_sz;
+	file->flush_ms = flush_ms;
+	file->rotate_sz = rotate_sz;
+	pthread_mutex_init(&file->mutex, NULL);
+	pthread_cond_init(&file->cond, NULL);
+	pthread_cond_init(&file->space, NULL);
+	pthread_cond_init(&file->done, NULL);
+	file->sink.write = &log_sink_file_write;
+	file->sink.flush = &log_sink_file_flush;
+	file->sink.priv = file;
+
+	if ((file->fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC,
+			0644)) == -1) {
+		r = errno;
+		moss_error("Failed open %s: %s(%d)\n", path, strerror(r), r);
+		goto finally;
+	}
+	if (fstat(file->fd, &st) == 0) file->file_sz = st.st_size;
+	if ((r = pthread_create(&file->thread, NULL, &log_sink_file_run,
+			file)) != 0) {
+		moss_error("Failed start file sink thread: %s(%d)\n", strerror(r), r);
+		close(file->fd);
+		goto finally;
+	}
+	return &file->sink;
+finally:
+	pthread_cond_destroy(&file->done);
+	pthread_cond_destroy(&file->space);
+	pthread_cond_destroy(&file->cond);
+	pthread_mutex_destroy(&file->mutex);
+	free(file);
+	return NULL;
+}
+
+unsigned long moss_log_sink_file_dropped(moss_log_sink_t *sink) {
+	log_sink_file_t *file = (log_sink_file_t*)sink->priv;
+
+	return __atomic_load_n(&file->dropped, __ATOMIC_RELAXED);
+}
+
+void moss_log_sink_file_close(moss_log_sink_t *sink) {
+	log_sink_file_t *file;
+
+	if (!sink) return;
+	file = (log_sink_file_t*)sink->priv;
+	pthread_mutex_lock(&file->mutex);
+	file->quit = 1;
+	pthread_cond_signal(&file->cond);
+	pthread_mutex_unlock(&file->mutex);
+	pthread_join(file->thread, NULL);
+	close(file->fd);
+	pthread_cond_destroy(&file->done);
+	pthread_cond_destroy(&file->space);
+	pthread_cond_destroy(&file->cond);
+	pthread_mutex_destroy(&file->mutex);
+	free(file);
+}
+
+/* Round up to page, and power of 2 for MOSS_BUF_POW2. */
+static size_t buf_cap_page(size_t cap, size_t pg) {
+	size_t cap2;
+
+	cap = (cap + pg - 1) / pg * pg;
+	if (!MOSS_BUF_POW2) return cap;
+	for (cap2 = pg; cap2 < cap; cap2 <<= 1);
+	return cap2;
+}
+
+/* Mask on power of 2 capable. */
+#define buf_flag_pow2(_cap) (((_cap) & ((_cap) - 1)) == 0 ? \
+		moss_buf_flag_pow2 : 0)
+
+/* Flight recorder file, header page followed by the ring of records. */
+#define LOG_SINK_MMAP_MAGIC 0x4c534f4d /* "MOSL" */
+
+typedef struct log_sink_mmap_hdr_rec {
+	uint32_t magic, hdr_sz;
+	uint64_t cap;
+	/** Position in upper and valid data in lower 32 bits, single store for
+	 * the reader always see consistent ring. */
+	uint64_t pos_lmt;
+} log_sink_mmap_hdr_t;
+
+typedef struct log_sink_mmap_rec {
+	moss_log_sink_t sink;
+	log_sink_mmap_hdr_t *hdr;
+	size_t map_sz;
+	moss_buf_t buf;
+	pthread_mutex_t mutex;
+} log_sink_mmap_t;
+
+#define log_sink_mmap_pos_lmt(_buf) (((uint64_t)(_buf)->pos << 32) | (_buf)->lmt)
+
+static int log_sink_mmap_write(moss_log_sink_t *sink, const moss_iov_t *iov,
+		int cnt) {
+	log_sink_mmap_t *mm = (log_sink_mmap_t*)sink->priv;
+	moss_iov_t old;
+	int i, r = 0;
+
+	pthread_mutex_lock(&mm->mutex);
+	for (i = 0; i < cnt; i++) {
+		while (moss_buf_msg_push(&mm->buf, NULL, &iov[i], 1) != 1) {
+			if (mm->buf.lmt <= 0) {
+				// larger than the ring
+				r = -1;
+				break;
+			}
+			// drop the oldest and publish before overwrite
+			moss_buf_msg_pop(&mm->buf, &old, 1);
+			__atomic_store_n(&mm->hdr->pos_lmt, log_sink_mmap_pos_lmt(&mm->buf),
+					__ATOMIC_RELEASE);
+		}
+		__atomic_store_n(&mm->hdr->pos_lmt, log_sink_mmap_pos_lmt(&mm->buf),
+				__ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&mm->mutex);
+	return r;
+}
+
+static int log_sink_mmap_flush(moss_log_sink_t *sink) {
+	log_sink_mmap_t *mm = (log_sink_mmap_t*)sink->priv;
+	int r;
+
+	// page cache already survive the process, sync for power loss
+	if (msync(mm->hdr, mm->map_sz, MS_SYNC) != 0) {
+		r = errno;
+		moss_error("Failed sync flight recorder: %s(%d)\n", strerror(r), r);
+		return -1;
+	}
+	return 0;
+}
+
+/* Map flight recorder file, validate the header when cap is 0. */
+static log_sink_mmap_hdr_t *log_sink_mmap_map(const char *path, size_t cap,
+		size_t *map_sz) {
+	size_t pg = sysconf(_SC_PAGESIZE);
+	log_sink_mmap_hdr_t *hdr;
+	struct stat st;
+	int fd, r;
+
+	if ((fd = open(path, cap > 0 ? (O_RDWR | O_CREAT | O_CLOEXEC) :
+			(O_RDONLY | O_CLOEXEC), 0644)) == -1) {
+		r = errno;
+		moss_error("Failed open %s: %s(%d)\n", path, strerror(r), r);
+		return NULL;
+	}
+	if (cap > 0) {
+		*map_sz = pg + cap;
+		if (ftruncate(fd, *map_sz) != 0) {
+			r = errno;
+			moss_error("Failed resize %s: %s(%d)\n", path, strerror(r), r);
+			close(fd);
+			return NULL;
+		}
+	} else {
+		if (fstat(fd, &st) != 0 || (size_t)st.st_size < pg) {
+			moss_error("Invalid flight recorder %s\n", path);
+			close(fd);
+			return NULL;
+		}
+		*map_sz = st.st_size;
+	}
+	if ((hdr = mmap(NULL, *map_sz, cap > 0 ? (PROT_READ | PROT_WRITE) :
+			PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+		r = errno;
+		moss_error("Failed map %s: %s(%d)\n", path, strerror(r), r);
+		close(fd);
+		return NULL;
+	}
+	close(fd);
+	return hdr;
+}
+
+moss_log_sink_t *moss_log_sink_mmap_open(const char *path, size_t cap) {
+	size_t pg = sysconf(_SC_PAGESIZE);
+	log_sink_mmap_t *mm;
+	uint64_t pos_lmt;
+
+	cap = buf_cap_page(cap, pg);
+	if (cap <= 0 || cap > UINT32_MAX - pg) {
+		moss_error("Invalid flight recorder size: %zu\n", cap);
+		return NULL;
+	}
+	if (!(mm = (log_sink_mmap_t*)calloc(1, sizeof(*mm)))) {
+		moss_error("Failed alloc flight recorder\n");
+		return NULL;
+	}
+	if (!(mm->hdr = log_sink_mmap_map(path, cap, &mm->map_sz))) {
+		free(mm);
+		return NULL;
+	}
+	mm->buf.data = (char*)mm->hdr + pg;
+	mm->buf.cap = cap;
+	mm->buf.flag = buf_flag_pow2(cap);
+	pos_lmt = mm->hdr->pos_lmt;
+	if (mm->hdr->magic == LOG_SINK_MMAP_MAGIC && mm->hdr->hdr_sz == pg
+			&& mm->hdr->cap == cap && (pos_lmt >> 32) < cap
+			&& (pos_lmt & UINT32_MAX) <= cap) {
+		// append to the previous run
+		mm->buf.pos = pos_lmt >> 32;
+		mm->buf.lmt = pos_lmt & UINT32_MAX;
+	} else {
+		mm->hdr->hdr_sz = pg;
+		mm->hdr->cap = cap;
+		mm->hdr->pos_lmt = 0;
+		__atomic_store_n(&mm->hdr->magic, LOG_SINK_MMAP_MAGIC, __ATOMIC_RELEASE);
+	}
+	pthread_mutex_init(&mm->mutex, NULL);
+	mm->sink.write = &log_sink_mmap_write;
+	mm->sink.flush = &log_sink_mmap_flush;
+	mm->sink.priv = mm;
+	return &mm->sink;
+}
+
+void moss_log_sink_mmap_close(moss_log_sink_t *sink) {
+	log_sink_mmap_t *mm;
+
+	if (!sink) return;
+	mm = (log_sink_mmap_t*)sink->priv;
+	munmap(mm->hdr, mm->map_sz);
+	pthread_mutex_destroy(&mm->mutex);
+	free(mm);
+}
+
+int moss_log_sink_mmap_recover(const char *path, int fd) {
+	log_sink_mmap_hdr_t *hdr;
+	moss_iov_t iov[LOG_ASYNC_IOV_MAX];
+	moss_buf_t buf;
+	size_t map_sz;
+	uint64_t pos_lmt;
+	int i, cnt, r = -1;
+
+	if (!(hdr = log_sink_mmap_map(path, 0, &map_sz))) return -1;
+	pos_lmt = hdr->pos_lmt;
+	if (hdr->magic != LOG_SINK_MMAP_MAGIC || hdr->hdr_sz + hdr->cap > map_sz
+			|| (pos_lmt >> 32) >= hdr->cap
+			|| (pos_lmt & UINT32_MAX) > hdr->cap
+			|| moss_buf_init(&buf, (char*)hdr + hdr->hdr_sz, hdr->cap, 0) != 0) {
+		moss_error("Invalid flight recorder %s\n", path);
+		goto finally;
+	}
+	buf.pos = pos_lmt >> 32;
+	buf.lmt = pos_lmt & UINT32_MAX;
+	while ((cnt = moss_buf_msg_pop(&buf, iov, LOG_ASYNC_IOV_MAX)) > 0) {
+		for (i = 0; i < cnt; i++) {
+			if (log_write(fd, iov[i].iov_base, iov[i].iov_len, NULL) != 0) {
+				r = errno;
+				moss_error("Failed write: %s(%d)\n", strerror(r), r);
+				r = -1;
+				goto finally;
+			}
+		}
+	}
+	if (buf.lmt > 0) {
+		// stopped at the record not inside valid data
+		moss_error("Corrupted flight recorder %s\n", path);
+		goto finally;
+	}
+	r = 0;
+finally:
+	munmap(hdr, map_sz);
+	return r;
+}
+
+int moss_log_write(const void *data, size_t sz) {
+	moss_log_sink_t *sink;
+
+	if (sz <= 0) return 0;
+	if (log_async.slots) return log_async_write(data, sz);
+	if ((sink = moss_log_sink_get())) {
+		moss_iov_t iov = {.iov_base = (void*)data, .iov_len = sz};
+
+		return (*sink->write)(sink, &iov, 1);
+	}
+	return log_write(STDOUT_FILENO, data, sz, NULL);
+}
+
+static int log_printf(unsigned lvl, const char *tag, long lno,
+		const char *fmt, ...) {
+	va_list va;
 	int r;
 
-	log_buf.pos = log_buf.lmt = 0;
-	r = moss_vlogf(&log_buf, lvl, tag, lno, fmt, va);
-	printf("%s", (char*)log_buf.data);
+	va_start(va, fmt);
+	r = log_vlog(lvl, tag, lno, fmt, va);
+	va_end(va);
 	return r;
 }
 
+int moss_vlog(unsigned lvl, const char *tag, long lno,
+		const char *fmt, va_list va) {
+	unsigned long rep;
+
+	if (!moss_log_enabled(lvl, tag)
+			|| moss_log_ratelimit_check(tag, lno, &rep) != 0) {
+		return 0;
+	}
+	if (rep > 0) {
+		log_printf(lvl, tag, lno, "last message repeated %lu times%s", rep,
+				moss_newline);
+	}
+	return log_vlog(lvl, tag, lno, fmt, va);
+}
+
 int moss_log(unsigned lvl, const char *tag, long lno,
 		const char *fmt, ...) {
 	va_list va;
@@ -34,14 +835,95 @@ int moss_log(unsigned lvl, const char *tag, long lno,
 }
 
 int moss_logt(moss_buf_t *buf, unsigned flag, const char *tag, long lno) {
+	return moss_log_ts_str(buf, moss_log_ts());
+}
+
+static int log_ts_clock = moss_log_clock_realtime;
+
+/* Realtime minus monotonic in microseconds. */
+static long long log_ts_ofs;
+
+/* Broken-down time only change per second. */
+static __thread struct {
+	time_t sec;
+	char str[9];
+} log_ts_cache = {.sec = (time_t)-1};
+
+static const char log_ts_digit[] =
+		"0001020304050607080910111213141516171819202122232425262728293031323334353637383940414243444546474849"
+		"5051525354555657585960616263646566676869707172737475767778798081828384858687888990919293949596979899";
+
+#define log_ts_2d(_s, _v) memcpy(_s, &log_ts_digit[(_v) * 2], 2)
+
+int moss_log_clock_set(int clk) {
+	struct timespec rt, mono;
+
+	switch (clk) {
+	case moss_log_clock_realtime:
+	case moss_log_clock_coarse:
+		break;
+	case moss_log_clock_monotonic:
+		if (clock_gettime(CLOCK_MONOTONIC, &mono) != 0
+				|| clock_gettime(CLOCK_REALTIME, &rt) != 0) {
+			int r = errno;
+			moss_error("Failed get clock: %s(%d)\n", strerror(r), r);
+			return -1;
+		}
+		log_ts_ofs = ((long long)rt.tv_sec - mono.tv_sec) * 1000000
+				+ (rt.tv_nsec - mono.tv_nsec) / 1000;
+		break;
+	default:
+		moss_error("Invalid clock: %d\n", clk);
+		return -1;
+	}
+	log_ts_clock = clk;
+	return 0;
+}
+
+unsigned long long moss_log_ts(void) {
 	struct timespec _t;
-	struct tm _tm;
 
-	clock_gettime(CLOCK_REALTIME, &_t);
-	localtime_r(&_t.tv_sec, &_tm);
+	switch (log_ts_clock) {
+	case moss_log_clock_coarse:
+		clock_gettime(CLOCK_REALTIME_COARSE, &_t);
+		break;
+	case moss_log_clock_monotonic:
+		clock_gettime(CLOCK_MONOTONIC, &_t);
+		return (unsigned long long)_t.tv_sec * 1000000 + _t.tv_nsec / 1000
+				+ log_ts_ofs;
+	default:
+		clock_gettime(CLOCK_REALTIME, &_t);
+		break;
+	}
+	return (unsigned long long)_t.tv_sec * 1000000 + _t.tv_nsec / 1000;
+}
+
+int moss_log_ts_str(moss_buf_t *buf, unsigned long long ts) {
+	time_t sec = ts / 1000000;
+	int usec = ts % 1000000;
+	char str[15];
+
+	if (sec != log_ts_cache.sec) {
+		struct tm _tm;
+
+		localtime_r(&sec, &_tm);
+		log_ts_2d(&log_ts_cache.str[0], _tm.tm_hour);
+		log_ts_cache.str[2] = ':';
+		log_ts_2d(&log_ts_cache.str[3], _tm.tm_min);
+		log_ts_cache.str[5] = ':';
+		// leap second
+		log_ts_2d(&log_ts_cache.str[6], _tm.tm_sec % 100);
+		log_ts_cache.str[8] = ':';
+		log_ts_cache.sec = sec;
+	}
+	memcpy(str, log_ts_cache.str, sizeof(log_ts_cache.str));
+	log_ts_2d(&str[9], usec / 10000);
+	log_ts_2d(&str[11], usec / 100 % 100);
+	log_ts_2d(&str[13], usec % 100);
 
-	return moss_buf_printf(buf, "%02d:%02d:%02d:%06d",
-			_tm.tm_hour, _tm.tm_min, _tm.tm_sec, (int)(_t.tv_nsec / 1000));
+	if (buf->cap - buf->lmt < sizeof(str)) return -1;
+	moss_buf_write(buf, str, sizeof(str));
+	return 0;
 }
 
 int moss_file_size(const char *path)
@@ -61,6 +943,380 @@ int moss_file_size(const char *path)
 	return st.st_size;
 }
 
+ssize_t moss_buf_read_fd(moss_buf_t *buf, int fd) {
+	struct iovec iov[2];
+	moss_iov_t seg[2];
+	int i, iov_cnt;
+	ssize_t r;
+
+	if ((iov_cnt = moss_buf_reserve(buf, buf->cap, seg)) <= 0) {
+		errno = ENOBUFS;
+		return -1;
+	}
+	for (i = 0; i < iov_cnt; i++) {
+		iov[i].iov_base = seg[i].iov_base;
+		iov[i].iov_len = seg[i].iov_len;
+	}
+	while ((r = readv(fd, iov, iov_cnt)) < 0 && errno == EINTR);
+	if (r > 0) moss_buf_commit(buf, r);
+	return r;
+}
+
+ssize_t moss_buf_write_fd(moss_buf_t *buf, int fd) {
+	struct iovec iov[2];
+	moss_iov_t seg[2];
+	int i, iov_cnt;
+	ssize_t r;
+
+	if ((iov_cnt = moss_buf_peek(buf, seg)) <= 0) return 0;
+	for (i = 0; i < iov_cnt; i++) {
+		iov[i].iov_base = seg[i].iov_base;
+		iov[i].iov_len = seg[i].iov_len;
+	}
+	while ((r = writev(fd, iov, iov_cnt)) < 0 && errno == EINTR);
+	if (r > 0) moss_buf_consume(buf, r);
+	return r;
+}
+
+ssize_t moss_buf_chain_write_fd(moss_buf_chain_t *chain, int fd) {
+	struct iovec iov[64];
+	moss_tailq_entry_t *qent;
+	moss_iov_t seg[2];
+	int i, seg_cnt, iov_cnt = 0, iov_max = MOSS_MIN(MOSS_ARRAYSIZE(iov), IOV_MAX);
+	ssize_t r;
+
+	TAILQ_FOREACH(qent, &chain->segs, entry) {
+		seg_cnt = moss_buf_peek(&MOSS_CONTAINER_OF(qent, moss_buf_seg_t,
+				qent)->buf, seg);
+		if (iov_cnt + seg_cnt > iov_max) break;
+		for (i = 0; i < seg_cnt; i++, iov_cnt++) {
+			iov[iov_cnt].iov_base = seg[i].iov_base;
+			iov[iov_cnt].iov_len = seg[i].iov_len;
+		}
+	}
+	if (iov_cnt <= 0) return 0;
+	while ((r = writev(fd, iov, iov_cnt)) < 0 && errno == EINTR);
+	if (r > 0) moss_buf_chain_drain(chain, r);
+	return r;
+}
+
+int moss_buf_mirror_alloc(moss_buf_t *buf, size_t cap) {
+	size_t pg = sysconf(_SC_PAGESIZE);
+	char *data;
+	int fd, r;
+
+	cap = buf_cap_page(cap, pg);
+	if ((fd = memfd_create("moss_buf", MFD_CLOEXEC)) == -1) {
+		r = errno;
+		moss_error("Failed create memfd: %s(%d)\n", strerror(r), r);
+		return -1;
+	}
+	if (ftruncate(fd, cap) != 0) {
+		r = errno;
+		moss_error("Failed resize memfd: %s(%d)\n", strerror(r), r);
+		close(fd);
+		return -1;
+	}
+	// reserve address space for both mapping
+	if ((data = mmap(NULL, cap + cap, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS,
+			-1, 0)) == MAP_FAILED) {
+		r = errno;
+		moss_error("Failed reserve address: %s(%d)\n", strerror(r), r);
+		close(fd);
+		return -1;
+	}
+	if (mmap(data, cap, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+			fd, 0) == MAP_FAILED || mmap(data + cap, cap,
+			PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+		r = errno;
+		moss_error("Failed map memfd: %s(%d)\n", strerror(r), r);
+		munmap(data, cap + cap);
+		close(fd);
+		return -1;
+	}
+	close(fd);
+	buf->data = data;
+	buf->cap = cap;
+	buf->pos = buf->lmt = 0;
+	buf->flag = (buf->flag & ~moss_buf_flag_pow2) | moss_buf_flag_mirror
+			| buf_flag_pow2(cap);
+	return 0;
+}
+
+void moss_buf_mirror_free(moss_buf_t *buf) {
+	if (!buf->data || !(buf->flag & moss_buf_flag_mirror)) return;
+	munmap(buf->data, buf->cap + buf->cap);
+	buf->data = NULL;
+	buf->cap = buf->pos = buf->lmt = 0;
+	buf->flag &= ~(moss_buf_flag_mirror | moss_buf_flag_pow2);
+}
+
+typedef struct copy_thread_rec {
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	moss_tailq_t q;
+	int quit;
+} copy_thread_t;
+
+static int copy_thread_submit(moss_copy_engine_t *engine, moss_copy_t *cp,
+		int cnt) {
+	copy_thread_t *ctx = (copy_thread_t*)engine->priv;
+	int i;
+
+	pthread_mutex_lock(&ctx->mutex);
+	if (ctx->quit) {
+		pthread_mutex_unlock(&ctx->mutex);
+		return -1;
+	}
+	for (i = 0; i < cnt; i++) {
+		TAILQ_INSERT_TAIL(&ctx->q, &cp[i].qent, entry);
+	}
+	pthread_cond_signal(&ctx->cond);
+	pthread_mutex_unlock(&ctx->mutex);
+	return 0;
+}
+
+static void *copy_thread_run(void *arg) {
+	copy_thread_t *ctx = (copy_thread_t*)arg;
+	moss_tailq_entry_t *qent;
+	moss_copy_t *cp;
+
+	pthread_mutex_lock(&ctx->mutex);
+	while (1) {
+		if (!(qent = TAILQ_FIRST(&ctx->q))) {
+			if (ctx->quit) break;
+			pthread_cond_wait(&ctx->cond, &ctx->mutex);
+			continue;
+		}
+		TAILQ_REMOVE(&ctx->q, qent, entry);
+		pthread_mutex_unlock(&ctx->mutex);
+		cp = MOSS_CONTAINER_OF(qent, moss_copy_t, qent);
+		memcpy(cp->tgt, cp->src, cp->sz);
+		__atomic_store_n(&cp->done, 1, __ATOMIC_RELEASE);
+		pthread_mutex_lock(&ctx->mutex);
+	}
+	pthread_mutex_unlock(&ctx->mutex);
+	return NULL;
+}
+
+int moss_copy_engine_thread_open(moss_copy_engine_t *engine) {
+	copy_thread_t *ctx;
+	int r;
+
+	if (!(ctx = (copy_thread_t*)calloc(1, sizeof(*ctx)))) {
+		moss_error("Failed alloc copy engine\n");
+		return -1;
+	}
+	TAILQ_INIT(&ctx->q);
+	pthread_mutex_init(&ctx->mutex, NULL);
+	pthread_cond_init(&ctx->cond, NULL);
+	if ((r = pthread_create(&ctx->thread, NULL, &copy_thread_run, ctx)) != 0) {
+		moss_error("Failed start copy engine: %s(%d)\n", strerror(r), r);
+		pthread_cond_destroy(&ctx->cond);
+		pthread_mutex_destroy(&ctx->mutex);
+		free(ctx);
+		return -1;
+	}
+	engine->submit = &copy_thread_submit;
+	engine->priv = ctx;
+	return 0;
+}
+
+void moss_copy_engine_thread_close(moss_copy_engine_t *engine) {
+	copy_thread_t *ctx = (copy_thread_t*)engine->priv;
+
+	if (!ctx) return;
+	pthread_mutex_lock(&ctx->mutex);
+	ctx->quit = 1;
+	pthread_cond_signal(&ctx->cond);
+	pthread_mutex_unlock(&ctx->mutex);
+	pthread_join(ctx->thread, NULL);
+	pthread_cond_destroy(&ctx->cond);
+	pthread_mutex_destroy(&ctx->mutex);
+	free(ctx);
+	engine->priv = NULL;
+}
+
+/* Tile of moss_matrix_mul_mt(), multiple of the packing block. */
+#define MATRIX_TILE_M 64
+#define MATRIX_TILE_N 256
+
+typedef struct matrix_job_rec {
+	int am, an, bn;
+	const float *a, *b;
+	float *c;
+	int tile_n, tile_cnt;
+	int next, done;
+} matrix_job_t;
+
+static struct {
+	pthread_t *thread;
+	int ready; /**< 1 for workers running, -1 for caller only, 0 not yet. */
+	int cnt, quit, busy;
+	unsigned long seq;
+	matrix_job_t *job;
+	pthread_mutex_t mutex, call;
+	pthread_cond_t cond, done;
+} matrix_pool = {
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+	.call = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+	.done = PTHREAD_COND_INITIALIZER,
+};
+
+/* Take tile until none, return count of tile done. */
+static int matrix_job_run(matrix_job_t *job) {
+	int tile, m, n, cnt = 0;
+
+	while ((tile = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED))
+			< job->tile_cnt) {
+		m = tile / job->tile_n * MATRIX_TILE_M;
+		n = tile % job->tile_n * MATRIX_TILE_N;
+		moss_matrix_mul_ld(MOSS_MIN(job->am - m, MATRIX_TILE_M), job->an,
+				job->a + (size_t)m * job->an, job->an,
+				MOSS_MIN(job->bn - n, MATRIX_TILE_N), job->b + n, job->bn,
+				job->c + (size_t)m * job->bn + n, job->bn);
+		cnt++;
+	}
+	return cnt;
+}
+
+static void *matrix_pool_run(void *arg) {
+	unsigned long seq = 0;
+	matrix_job_t *job;
+	int cnt;
+
+	(void)arg;
+	pthread_mutex_lock(&matrix_pool.mutex);
+	while (1) {
+		while (!matrix_pool.quit && (seq == matrix_pool.seq
+				|| !matrix_pool.job)) {
+			pthread_cond_wait(&matrix_pool.cond, &matrix_pool.mutex);
+		}
+		if (matrix_pool.quit) break;
+		seq = matrix_pool.seq;
+		job = matrix_pool.job;
+		matrix_pool.busy++;
+		pthread_mutex_unlock(&matrix_pool.mutex);
+
+		cnt = matrix_job_run(job);
+
+		pthread_mutex_lock(&matrix_pool.mutex);
+		job->done += cnt;
+		if (--matrix_pool.busy <= 0) pthread_cond_signal(&matrix_pool.done);
+	}
+	pthread_mutex_unlock(&matrix_pool.mutex);
+	return NULL;
+}
+
+int moss_matrix_pool_open(int cnt) {
+	int r;
+
+	pthread_mutex_lock(&matrix_pool.call);
+	if (matrix_pool.thread) {
+		pthread_mutex_unlock(&matrix_pool.call);
+		return 0;
+	}
+	if (cnt <= 0 && (cnt = sysconf(_SC_NPROCESSORS_ONLN) - 1) <= 0) {
+		// single cpu, caller only
+		__atomic_store_n(&matrix_pool.ready, -1, __ATOMIC_RELEASE);
+		pthread_mutex_unlock(&matrix_pool.call);
+		return 0;
+	}
+	if (!(matrix_pool.thread = (pthread_t*)malloc(sizeof(pthread_t) * cnt))) {
+		__atomic_store_n(&matrix_pool.ready, -1, __ATOMIC_RELEASE);
+		pthread_mutex_unlock(&matrix_pool.call);
+		moss_error("Failed alloc matrix pool\n");
+		return -1;
+	}
+	matrix_pool.quit = 0;
+	for (matrix_pool.cnt = 0; matrix_pool.cnt < cnt; matrix_pool.cnt++) {
+		if ((r = pthread_create(&matrix_pool.thread[matrix_pool.cnt], NULL,
+				&matrix_pool_run, NULL)) != 0) {
+			moss_error("Failed start matrix thread: %s(%d)\n", strerror(r), r);
+			break;
+		}
+	}
+	if (matrix_pool.cnt <= 0) {
+		free(matrix_pool.thread);
+		matrix_pool.thread = NULL;
+	}
+	__atomic_store_n(&matrix_pool.ready, matrix_pool.thread ? 1 : -1,
+			__ATOMIC_RELEASE);
+	pthread_mutex_unlock(&matrix_pool.call);
+	return matrix_pool.thread ? 0 : -1;
+}
+
+void moss_matrix_pool_close(void) {
+	int i;
+
+	pthread_mutex_lock(&matrix_pool.call);
+	if (!matrix_pool.thread) {
+		pthread_mutex_unlock(&matrix_pool.call);
+		return;
+	}
+	pthread_mutex_lock(&matrix_pool.mutex);
+	matrix_pool.quit = 1;
+	pthread_cond_broadcast(&matrix_pool.cond);
+	pthread_mutex_unlock(&matrix_pool.mutex);
+	for (i = 0; i < matrix_pool.cnt; i++) {
+		pthread_join(matrix_pool.thread[i], NULL);
+	}
+	free(matrix_pool.thread);
+	matrix_pool.thread = NULL;
+	matrix_pool.cnt = 0;
+	__atomic_store_n(&matrix_pool.ready, 0, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&matrix_pool.call);
+}
+
+/* Start the pool at the first use, the result kept even no worker. */
+static int matrix_pool_ready(void) {
+	int ready = __atomic_load_n(&matrix_pool.ready, __ATOMIC_ACQUIRE);
+
+	if (ready == 0) {
+		moss_matrix_pool_open(0);
+		ready = __atomic_load_n(&matrix_pool.ready, __ATOMIC_ACQUIRE);
+	}
+	return ready;
+}
+
+void moss_matrix_mul_mt(int am, int an, float *a, int bn, float *b,
+		float *c) {
+	matrix_job_t job = {
+		.am = am, .an = an, .bn = bn, .a = a, .b = b, .c = c,
+	};
+	int cnt;
+
+	if ((long long)am * an * bn < MOSS_MATRIX_MUL_MT_MIN
+			|| matrix_pool_ready() <= 0) {
+		moss_matrix_mul(am, an, a, bn, b, c);
+		return;
+	}
+	job.tile_n = (bn + MATRIX_TILE_N - 1) / MATRIX_TILE_N;
+	job.tile_cnt = (am + MATRIX_TILE_M - 1) / MATRIX_TILE_M * job.tile_n;
+
+	// one job at a time
+	pthread_mutex_lock(&matrix_pool.call);
+	pthread_mutex_lock(&matrix_pool.mutex);
+	matrix_pool.job = &job;
+	matrix_pool.seq++;
+	pthread_cond_broadcast(&matrix_pool.cond);
+	pthread_mutex_unlock(&matrix_pool.mutex);
+
+	cnt = matrix_job_run(&job);
+
+	pthread_mutex_lock(&matrix_pool.mutex);
+	job.done += cnt;
+	// workers may still run the last tiles
+	while (job.done < job.tile_cnt || matrix_pool.busy > 0) {
+		pthread_cond_wait(&matrix_pool.done, &matrix_pool.mutex);
+	}
+	matrix_pool.job = NULL;
+	pthread_mutex_unlock(&matrix_pool.mutex);
+	pthread_mutex_unlock(&matrix_pool.call);
+}
+
 unsigned long moss_ts1_get(unsigned long *ts0) {
 	struct timespec ts1;
 
@@ -0,0 +1,169 @@
+#include "test.h"
+
+/* Write and read back through the wrap, check the data order. */
+static int buf_wrap_check(moss_buf_t *buf) {
+	unsigned char in[64], out[64];
+	unsigned wr_seq = 0, rd_seq = 0;
+	size_t sz, left, i;
+	int it;
+
+	for (it = 0; it < 1000; it++) {
+		sz = (it * 7) % 20 + 1;
+		for (i = 0; i < sz; i++) in[i] = wr_seq + i;
+		left = moss_buf_write(buf, in, sz);
+		wr_seq += sz - left;
+		sz = moss_buf_read(buf, out, (it * 5) % 23 + 1);
+		for (i = 0; i < sz; i++) {
+			if (out[i] != (unsigned char)(rd_seq + i)) return -1;
+		}
+		rd_seq += sz;
+	}
+	return 0;
+}
+
+static moss_unitest_flag_t test_buf_wrap(moss_unitest_case_t *runner) {
+	char mem[128];
+	moss_buf_t buf;
+
+	MOSS_UNITEST_ASSERT_RETURN(moss_buf_init(&buf, mem, 32, 0) == 0,
+			runner, failed);
+	MOSS_UNITEST_ASSERT_RETURN(buf.flag & moss_buf_flag_pow2, runner, failed);
+	MOSS_UNITEST_ASSERT_RETURN(buf_wrap_check(&buf) == 0, runner, failed);
+
+	MOSS_UNITEST_ASSERT_RETURN(moss_buf_init(&buf, mem, 31,
+			moss_buf_flag_pow2) != 0, runner, failed);
+#if !MOSS_BUF_POW2
+	MOSS_UNITEST_ASSERT_RETURN(moss_buf_init(&buf, mem, 100, 0) == 0,
+			runner, failed);
+	MOSS_UNITEST_ASSERT_RETURN(!(buf.flag & moss_buf_flag_pow2), runner,
+			failed);
+	MOSS_UNITEST_ASSERT_RETURN(buf_wrap_check(&buf) == 0, runner, failed);
+#endif
+	return moss_unitest_flag_result_pass;
+}
+
+static moss_unitest_flag_t test_buf_spsc_wrap(moss_unitest_case_t *runner) {
+	unsigned char mem[64], in[64], out[64];
+	moss_buf_spsc_t spsc = {.data = mem, .cap = 32};
+	unsigned wr_seq = 0, rd_seq = 0;
+	size_t sz, left, i;
+	int it;
+
+	for (it = 0; it < 1000; it++) {
+		sz = (it * 7) % 20 + 1;
+		for (i = 0; i < sz; i++) in[i] = wr_seq + i;
+		left = moss_buf_spsc_write(&spsc, in, sz);
+		wr_seq += sz - left;
+		sz = moss_buf_spsc_read(&spsc, out, (it * 5) % 23 + 1);
+		for (i = 0; i < sz; i++) {
+			MOSS_UNITEST_ASSERT_RETURN(out[i] == (unsigned char)(rd_seq + i),
+					runner, failed);
+		}
+		rd_seq += sz;
+	}
+	return moss_unitest_flag_result_pass;
+}
+
+/* Printf across the end of data memory keep valid data in place. */
+static moss_unitest_flag_t test_buf_printf_wrap(moss_unitest_case_t *runner) {
+	static const struct {
+		size_t pos, lmt;
+		const char *txt;
+	} cases[] = {
+		{20, 4, "0123456789"}, /* contiguous tail */
+		{20, 8, "0123456789"}, /* front hold the whole text */
+		{6, 21, "0123456789"}, /* format aside */
+	};
+	char mem[32], out[32];
+	moss_buf_t buf;
+	unsigned i;
+
+	for (i = 0; i < MOSS_ARRAYSIZE(cases); i++) {
+		moss_buf_init(&buf, mem, sizeof(mem), 0);
+		memset(mem, 'x', sizeof(mem));
+		buf.pos = cases[i].pos;
+		buf.lmt = cases[i].lmt;
+		MOSS_UNITEST_ASSERT_RETURN(moss_buf_printf(&buf, "%s",
+				cases[i].txt) == 0, runner, failed);
+		MOSS_UNITEST_ASSERT_RETURN(buf.pos == cases[i].pos, runner, failed);
+		MOSS_UNITEST_ASSERT_RETURN(buf.lmt == cases[i].lmt
+				+ strlen(cases[i].txt), runner, failed);
+		moss_buf_read(&buf, out, cases[i].lmt);
+		MOSS_UNITEST_ASSERT_RETURN(memchr(out, 'x', cases[i].lmt) == out,
+				runner, failed);
+		MOSS_UNITEST_ASSERT_RETURN(moss_buf_read(&buf, out, sizeof(out))
+				== strlen(cases[i].txt), runner, failed);
+		MOSS_UNITEST_ASSERT_RETURN(memcmp(out, cases[i].txt,
+				strlen(cases[i].txt)) == 0, runner, failed);
+	}
+
+	// insufficient space keep all
+	moss_buf_init(&buf, mem, sizeof(mem), 0);
+	buf.pos = 10;
+	buf.lmt = 25;
+	MOSS_UNITEST_ASSERT_RETURN(moss_buf_printf(&buf, "%s", "0123456789")
+			!= 0, runner, failed);
+	MOSS_UNITEST_ASSERT_RETURN(buf.pos == 10 && buf.lmt == 25, runner, failed);
+	return moss_unitest_flag_result_pass;
+}
+
+#define BUF_BENCH_CAP (64 * 1024)
+#define BUF_BENCH_BYTES (256 * 1024 * 1024)
+
+/* Write and read pairs of sz bytes, return nanoseconds per pair. */
+static double buf_bench(moss_buf_t *buf, const void *in, void *out,
+		size_t sz) {
+	unsigned long long ns;
+	size_t i, cnt = BUF_BENCH_BYTES / sz / 16;
+
+	// not aligned to the capable for the wrap
+	moss_buf_write(buf, in, 3);
+	ns = test_ns();
+	for (i = 0; i < cnt; i++) {
+		moss_buf_write(buf, in, sz);
+		moss_buf_read(buf, out, sz);
+	}
+	ns = test_ns() - ns;
+	buf->pos = buf->lmt = 0;
+	return (double)ns / cnt;
+}
+
+/* Wrap with mask or compare and subtract for 1, 64 and 4096 bytes. */
+static moss_unitest_flag_t test_buf_bench(moss_unitest_case_t *runner) {
+	static const size_t sz[] = {1, 64, 4096};
+	moss_buf_t buf;
+	char *mem, *in, *out;
+	unsigned i;
+
+	MOSS_UNITEST_ASSERT_RETURN((mem = malloc(BUF_BENCH_CAP + 4096 * 2)),
+			runner, failed);
+	in = mem + BUF_BENCH_CAP;
+	out = in + 4096;
+	memset(in, 0x5a, 4096);
+	for (i = 0; i < MOSS_ARRAYSIZE(sz); i++) {
+		double ns_mask;
+
+		moss_buf_init(&buf, mem, BUF_BENCH_CAP, 0);
+		ns_mask = buf_bench(&buf, in, out, sz[i]);
+#if MOSS_BUF_POW2
+		moss_info("write+read %zu bytes: mask %.1f ns\n", sz[i], ns_mask);
+#else
+		// same capable without the flag
+		buf.flag &= ~moss_buf_flag_pow2;
+		moss_info("write+read %zu bytes: mask %.1f ns, compare %.1f ns\n",
+				sz[i], ns_mask, buf_bench(&buf, in, out, sz[i]));
+#endif
+	}
+	free(mem);
+	return moss_unitest_flag_result_pass;
+}
+
+void test_buf_add(moss_unitest_t *suite) {
+	static moss_unitest_t buf_suite;
+
+	MOSS_UNITEST_INIT2(suite, &buf_suite, "buf");
+	MOSS_UNITEST_CASE_INIT4(&buf_suite, "wrap", &test_buf_wrap);
+	MOSS_UNITEST_CASE_INIT4(&buf_suite, "spsc_wrap", &test_buf_spsc_wrap);
+	MOSS_UNITEST_CASE_INIT4(&buf_suite, "printf_wrap", &test_buf_printf_wrap);
+	MOSS_UNITEST_CASE_INIT4(&buf_suite, "bench", &test_buf_bench);
+}
@@ -0,0 +1,172 @@
+/* Message log test and benchmark. */
+#include "test.h"
+
+#define LOG_LAT_CNT 100000
+
+/* Sink discard the lines, only count the bytes. */
+static int log_sink_null_write(moss_log_sink_t *sink, const moss_iov_t *iov,
+		int cnt) {
+	int i;
+
+	for (i = 0; i < cnt; i++) {
+		__atomic_fetch_add((size_t*)sink->priv, iov[i].iov_len,
+				__ATOMIC_RELAXED);
+	}
+	return 0;
+}
+
+static int log_lat_cmp(const void *a, const void *b) {
+	unsigned a1 = *(const unsigned*)a, b1 = *(const unsigned*)b;
+
+	return a1 < b1 ? -1 : a1 > b1 ? 1 : 0;
+}
+
+/* Latency of each moss_info() into lat, sorted. */
+static void log_lat_run(unsigned *lat) {
+	unsigned long long ns;
+	int i;
+
+	for (i = 0; i < LOG_LAT_CNT; i++) {
+		ns = test_ns();
+		moss_info("rx %d bytes from %s\n", i, "eth0");
+		lat[i] = (unsigned)(test_ns() - ns);
+	}
+	qsort(lat, LOG_LAT_CNT, sizeof(*lat), &log_lat_cmp);
+}
+
+/* Log call latency p50/p99 with synchronous and asynchronous log.
+ *
+ * The time include clock_gettime() overhead, lines reach the null sink.
+ */
+static moss_unitest_flag_t test_log_latency(moss_unitest_case_t *runner) {
+	size_t bytes = 0;
+	moss_log_sink_t sink = {
+		.write = &log_sink_null_write,
+		.priv = &bytes,
+		.kv_enc = moss_log_kv_enc_logfmt,
+	}, *sink_prev;
+	unsigned *lat, lat_sync[3];
+	unsigned long dropped;
+
+	MOSS_UNITEST_ASSERT_RETURN((lat = (unsigned*)malloc(sizeof(*lat)
+			* LOG_LAT_CNT)), runner, failed);
+	sink_prev = moss_log_sink_set(&sink);
+
+	log_lat_run(lat);
+	lat_sync[0] = lat[LOG_LAT_CNT / 2];
+	lat_sync[1] = lat[LOG_LAT_CNT * 99 / 100];
+	lat_sync[2] = lat[LOG_LAT_CNT - 1];
+
+	if (moss_log_async_start(LOG_LAT_CNT, 0) != 0) {
+		moss_log_sink_set(sink_prev);
+		free(lat);
+		MOSS_UNITEST_ASSERT_RETURN(0, runner, failed);
+	}
+	dropped = moss_log_async_dropped();
+	log_lat_run(lat);
+	moss_log_async_stop();
+	dropped = moss_log_async_dropped() - dropped;
+	moss_log_sink_set(sink_prev);
+
+	moss_info("sync p50 %u ns, p99 %u ns, max %u ns\n", lat_sync[0],
+			lat_sync[1], lat_sync[2]);
+	moss_info("async p50 %u ns, p99 %u ns, max %u ns, dropped %lu\n",
+			lat[LOG_LAT_CNT / 2], lat[LOG_LAT_CNT * 99 / 100],
+			lat[LOG_LAT_CNT - 1], dropped);
+	free(lat);
+	MOSS_UNITEST_ASSERT_RETURN(bytes > 0, runner, failed);
+	return moss_unitest_flag_result_pass;
+}
+
+/* The same call site for all stream. */
+static void blog_rx(moss_blog_t *blog, int len, const char *from) {
+	moss_blog(blog, moss_log_level_info, "rx %d bytes from %s 100%%\n",
+			len, from);
+}
+
+/* Decode all records, 0 when the text end with msg. */
+static int blog_check(moss_blog_decoder_t *dec, moss_buf_t *buf,
+		const char *msg) {
+	char mem[1024 + 1];
+	moss_buf_t txt = {.data = mem, .cap = sizeof(mem) - 1};
+	size_t len = strlen(msg);
+
+	if (moss_blog_decode(dec, buf, &txt) <= 0 || buf->lmt != 0 ||
+			txt.lmt < len) {
+		return -1;
+	}
+	mem[txt.lmt] = '\0';
+	return strcmp(mem + txt.lmt - len, msg);
+}
+
+/* Call site definition per stream, long string and rejected format. */
+static moss_unitest_flag_t test_log_blog(moss_unitest_case_t *runner) {
+	char mem[2][1024], str[MOSS_LOG_LINE_MAX], msg[MOSS_LOG_LINE_MAX + 32];
+	moss_buf_t buf[2];
+	moss_blog_t blog[2];
+	moss_blog_decoder_t dec[3] = {{0}};
+	int r, i;
+
+	for (i = 0; i < 2; i++) {
+		moss_buf_init(&buf[i], mem[i], sizeof(mem[i]), 0);
+		moss_blog_init(&blog[i], &buf[i]);
+	}
+
+	// each stream carry the definition
+	blog_rx(&blog[0], 10, "eth0");
+	blog_rx(&blog[1], 11, "eth0");
+	r = blog_check(&dec[0], &buf[0], "rx 10 bytes from eth0 100%\n");
+	MOSS_UNITEST_ASSERT_RETURN(r == 0, runner, failed);
+	r = blog_check(&dec[1], &buf[1], "rx 11 bytes from eth0 100%\n");
+	MOSS_UNITEST_ASSERT_RETURN(r == 0, runner, failed);
+
+	// define again for another decoder after initialize again
+	moss_blog_init(&blog[1], &buf[1]);
+	blog_rx(&blog[1], 12, "eth1");
+	r = blog_check(&dec[2], &buf[1], "rx 12 bytes from eth1 100%\n");
+	MOSS_UNITEST_ASSERT_RETURN(r == 0, runner, failed);
+
+	// string not truncated, or fail the call
+	memset(str, 's', 200);
+	str[200] = '\0';
+	blog_rx(&blog[0], 13, str);
+	snprintf(msg, sizeof(msg), "rx 13 bytes from %s 100%%\n", str);
+	r = blog_check(&dec[0], &buf[0], msg);
+	MOSS_UNITEST_ASSERT_RETURN(r == 0, runner, failed);
+	memset(str, 's', sizeof(str) - 1);
+	str[sizeof(str) - 1] = '\0';
+	blog_rx(&blog[0], 14, str);
+	MOSS_UNITEST_ASSERT_RETURN(buf[0].lmt == 0, runner, failed);
+
+	// conversion could not take back the same text
+	moss_blog(&blog[0], moss_log_level_info, "errno %m\n");
+	MOSS_UNITEST_ASSERT_RETURN(buf[0].lmt == 0, runner, failed);
+
+	for (i = 0; i < 3; i++) moss_blog_decoder_free(&dec[i]);
+	return moss_unitest_flag_result_pass;
+}
+
+/* File sink count the lines failed to write, ie. no space on device. */
+static moss_unitest_flag_t test_log_file_drop(moss_unitest_case_t *runner) {
+	moss_log_sink_t *sink;
+	moss_iov_t iov = {.iov_base = "line 1\nline 2\n", .iov_len = 14};
+	unsigned long dropped;
+
+	MOSS_UNITEST_ASSERT_RETURN((sink = moss_log_sink_file_open("/dev/full",
+			0, 0, 0, 0)), runner, failed);
+	(*sink->write)(sink, &iov, 1);
+	(*sink->flush)(sink);
+	dropped = moss_log_sink_file_dropped(sink);
+	moss_log_sink_file_close(sink);
+	MOSS_UNITEST_ASSERT_RETURN(dropped == 2, runner, failed);
+	return moss_unitest_flag_result_pass;
+}
+
+void test_log_add(moss_unitest_t *suite) {
+	static moss_unitest_t log_suite;
+
+	MOSS_UNITEST_INIT2(suite, &log_suite, "log");
+	MOSS_UNITEST_CASE_INIT4(&log_suite, "blog", &test_log_blog);
+	MOSS_UNITEST_CASE_INIT4(&log_suite, "file_drop", &test_log_file_drop);
+	MOSS_UNITEST_CASE_INIT4(&log_suite, "latency", &test_log_latency);
+}
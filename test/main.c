@@ -0,0 +1,27 @@
+/* Unit test and benchmark on pc.
+ *
+ * gcc -O2 -Iinclude -Iopenbsd -Ipc/include -Itest test/\*.c moss.c unitest.c
+ *   pc/sys.c -lpthread -lm
+ */
+#include "test.h"
+
+int main(int argc, char **argv) {
+	moss_unitest_report_t report = {.log = &moss_log};
+	moss_unitest_t suite;
+
+	(void)argc;
+	(void)argv;
+	// case result from moss_unitest_report()
+	moss_log_level_tag_set("moss_unitest_report", moss_log_level_debug);
+	MOSS_UNITEST_INIT(&suite, "moss");
+	test_buf_add(&suite);
+	test_log_add(&suite);
+	test_matrix_add(&suite);
+	MOSS_UNITEST_RUN(&suite);
+	moss_unitest_report(&suite, &report);
+	moss_info("%s, PASS: %d, FAILED: %d, TOTAL: %d\n",
+			MOSS_UNITEST_RESULT_STR(suite.runner.flag_result, "UNKNOWN"),
+			report.pass, report.failed, report.total);
+	moss_log_flush();
+	return suite.runner.flag_result == moss_unitest_flag_result_pass ? 0 : 1;
+}
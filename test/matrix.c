@@ -0,0 +1,321 @@
+/* Matrix multiply test. */
+#include "test.h"
+
+#include <math.h>
+
+/* Pseudo random in [-1, 1). */
+static void mat_fill(float *x, int cnt, unsigned seed) {
+	while (cnt-- > 0) {
+		seed = seed * 1103515245u + 12345u;
+		*x++ = (float)((seed >> 8) & 0xffff) / 32768.0f - 1.0f;
+	}
+}
+
+/* Reference in double, c = alpha * op(a) * op(b) + beta * c. */
+static void mat_ref(int ta, int tb, int m, int n, int k, float alpha,
+		const float *a, int lda, const float *b, int ldb, float beta,
+		float *c, int ldc) {
+	int i, j, z;
+
+	for (i = 0; i < m; i++) {
+		for (j = 0; j < n; j++) {
+			double sum = 0;
+
+			for (z = 0; z < k; z++) {
+				sum += (double)(ta ? a[z * lda + i] : a[i * lda + z])
+						* (tb ? b[j * ldb + z] : b[z * ldb + j]);
+			}
+			c[i * ldc + j] = (float)(alpha * sum + (beta == 0.0f ? 0.0 :
+					(double)beta * c[i * ldc + j]));
+		}
+	}
+}
+
+/* Count of element of m * n differ more than tol, NaN count. */
+static int mat_diff(int m, int n, const float *c, int ldc, const float *ref,
+		int ldr, float tol) {
+	int i, j, cnt = 0;
+
+	for (i = 0; i < m; i++) {
+		for (j = 0; j < n; j++) {
+			if (!(fabsf(c[i * ldc + j] - ref[i * ldr + j]) <= tol)) cnt++;
+		}
+	}
+	return cnt;
+}
+
+/* Size cover edge tile of rows and columns and k over the block (256). */
+static const struct {
+	int m, n, k;
+} mat_sz[] = {
+	{1, 1, 1}, {3, 7, 5}, {4, 32, 16}, {65, 33, 257}, {67, 70, 300},
+	{5, 3, 600},
+};
+
+/* Blocked multiply against the reference, sub-matrix keep the outside. */
+static moss_unitest_flag_t test_matrix_mul(moss_unitest_case_t *runner) {
+	float *a, *b, *c, *ref;
+	int i, m, n, k, ld, r;
+
+	MOSS_UNITEST_ASSERT_RETURN((a = (float*)malloc(sizeof(float) * 4
+			* 700 * 700)), runner, failed);
+	b = a + 700 * 700;
+	c = b + 700 * 700;
+	ref = c + 700 * 700;
+	for (i = 0; i < (int)MOSS_ARRAYSIZE(mat_sz); i++) {
+		m = mat_sz[i].m;
+		n = mat_sz[i].n;
+		k = mat_sz[i].k;
+		mat_fill(a, m * k, i);
+		mat_fill(b, k * n, i + 100);
+		// c not read
+		memset(c, 0xff, sizeof(float) * m * n);
+		moss_matrix_mul(m, k, a, n, b, c);
+		mat_ref(0, 0, m, n, k, 1.0f, a, k, b, n, 0.0f, ref, n);
+		r = mat_diff(m, n, c, n, ref, n, 1e-5f * k);
+		MOSS_UNITEST_ASSERT_RETURN(r == 0, runner, failed);
+
+		// sub-matrix, the same result and the outside untouched
+		ld = n + 3;
+		mat_fill(c, (m + 1) * ld, i + 200);
+		memcpy(ref, c, sizeof(float) * (m + 1) * ld);
+		moss_matrix_mul_ld(m, k, a, k, n, b, n, c + ld + 1, ld);
+		mat_ref(0, 0, m, n, k, 1.0f, a, k, b, n, 0.0f, ref + ld + 1, ld);
+		r = mat_diff(m, n, c + ld + 1, ld, ref + ld + 1, ld, 1e-5f * k);
+		MOSS_UNITEST_ASSERT_RETURN(r == 0, runner, failed);
+		r = mat_diff(1, ld, c, ld, ref, ld, 0.0f)
+				+ mat_diff(m, 1, c + ld, ld, ref + ld, ld, 0.0f)
+				+ mat_diff(m, 2, c + ld + n + 1, ld, ref + ld + n + 1, ld, 0.0f);
+		MOSS_UNITEST_ASSERT_RETURN(r == 0, runner, failed);
+	}
+	free(a);
+	return moss_unitest_flag_result_pass;
+}
+
+/* Worker threads split to tiles, bitwise the same to the caller only. */
+static moss_unitest_flag_t test_matrix_mul_mt(moss_unitest_case_t *runner) {
+	static const struct {
+		int m, n, k;
+	} sz[] = {
+		{130, 300, 150}, {97, 257, 113}, {200, 20, 250}, {30, 30, 30},
+	};
+	float *a, *b, *c, *ref;
+	int i, m, n, k;
+
+	MOSS_UNITEST_ASSERT_RETURN((a = (float*)malloc(sizeof(float) * 4
+			* 300 * 300)), runner, failed);
+	b = a + 300 * 300;
+	c = b + 300 * 300;
+	ref = c + 300 * 300;
+	// workers even on single cpu
+	if (moss_matrix_pool_open(2) != 0) {
+		free(a);
+		MOSS_UNITEST_ASSERT_RETURN(0, runner, failed);
+	}
+	for (i = 0; i < (int)MOSS_ARRAYSIZE(sz); i++) {
+		m = sz[i].m;
+		n = sz[i].n;
+		k = sz[i].k;
+		mat_fill(a, m * k, i);
+		mat_fill(b, k * n, i + 100);
+		moss_matrix_mul(m, k, a, n, b, ref);
+		memset(c, 0xff, sizeof(float) * m * n);
+		moss_matrix_mul_mt(m, k, a, n, b, c);
+		if (memcmp(c, ref, sizeof(float) * m * n) != 0) break;
+	}
+	moss_matrix_pool_close();
+	free(a);
+	MOSS_UNITEST_ASSERT_RETURN(i >= (int)MOSS_ARRAYSIZE(sz), runner, failed);
+	return moss_unitest_flag_result_pass;
+}
+
+/* Four transpose, alpha, beta 0 not read c, n 1 go matrix vector. */
+static moss_unitest_flag_t test_matrix_sgemm(moss_unitest_case_t *runner) {
+	static const struct {
+		int m, n, k;
+	} sz[] = {
+		{1, 1, 1}, {5, 3, 17}, {67, 70, 300}, {9, 1, 260},
+	};
+	static const float alpha[] = {0.75f, 0.75f, 0.75f, 0.0f},
+			beta[] = {0.0f, 1.0f, -0.5f, 0.0f};
+	float *a, *b, *c, *ref;
+	int i, j, t, m, n, k, lda, ldb, ldc, r;
+
+	MOSS_UNITEST_ASSERT_RETURN((a = (float*)malloc(sizeof(float) * 4
+			* 400 * 400)), runner, failed);
+	b = a + 400 * 400;
+	c = b + 400 * 400;
+	ref = c + 400 * 400;
+	for (i = 0; i < (int)MOSS_ARRAYSIZE(sz); i++) {
+		m = sz[i].m;
+		n = sz[i].n;
+		k = sz[i].k;
+		for (t = 0; t < 4; t++) {
+			// leading dimension larger than the sub-matrix
+			lda = (t & 1 ? m : k) + 2;
+			ldb = (t & 2 ? k : n) + 1;
+			ldc = n + 3;
+			mat_fill(a, (t & 1 ? k : m) * lda, i + t);
+			mat_fill(b, (t & 2 ? n : k) * ldb, i + t + 100);
+			for (j = 0; j < (int)MOSS_ARRAYSIZE(beta); j++) {
+				if (beta[j] == 0.0f) {
+					// c not read
+					for (r = 0; r < m * ldc; r++) c[r] = NAN;
+				} else {
+					mat_fill(c, m * ldc, i + t + 200);
+				}
+				memcpy(ref, c, sizeof(float) * m * ldc);
+				moss_sgemm(t & 1, t & 2, m, n, k, alpha[j], a, lda, b, ldb,
+						beta[j], c, ldc);
+				mat_ref(t & 1, t & 2, m, n, k, alpha[j], a, lda, b, ldb,
+						beta[j], ref, ldc);
+				r = mat_diff(m, n, c, ldc, ref, ldc, 1e-5f * k);
+				MOSS_UNITEST_ASSERT_RETURN(r == 0, runner, failed);
+			}
+		}
+	}
+
+	// matrix vector with stride of x and y
+	for (t = 0; t < 2; t++) {
+		m = 37;
+		n = 300;
+		lda = n + 1;
+		mat_fill(a, m * lda, t);
+		mat_fill(b, (t ? m : n) * 2, t + 100);
+		mat_fill(c, (t ? n : m) * 3, t + 200);
+		memcpy(ref, c, sizeof(float) * (t ? n : m) * 3);
+		moss_sgemv(t, m, n, 0.5f, a, lda, b, 2, 2.0f, c, 3);
+		if (t) {
+			mat_ref(1, 0, n, 1, m, 0.5f, a, lda, b, 2, 2.0f, ref, 3);
+		} else {
+			mat_ref(0, 0, m, 1, n, 0.5f, a, lda, b, 2, 2.0f, ref, 3);
+		}
+		r = mat_diff(t ? n : m, 1, c, 3, ref, 3, 1e-5f * (t ? m : n));
+		MOSS_UNITEST_ASSERT_RETURN(r == 0, runner, failed);
+	}
+	free(a);
+	return moss_unitest_flag_result_pass;
+}
+
+/* Q15 vector kernel bit exact to the reference, extreme value saturate. */
+static moss_unitest_flag_t test_matrix_q15(moss_unitest_case_t *runner) {
+	static const struct {
+		int m, n, k;
+	} sz[] = {
+		{1, 1, 1}, {3, 37, 17}, {5, 33, 64}, {2, 70, 100}, {4, 16, 4},
+	};
+	int16_t a[4096], b[8192], c[4096], ref[4096];
+	unsigned seed = 1;
+	int i, j, f, m, n, k;
+
+	for (i = 0; i < (int)MOSS_ARRAYSIZE(sz); i++) {
+		m = sz[i].m;
+		n = sz[i].n;
+		k = sz[i].k;
+		for (j = 0; j < m * k; j++) {
+			seed = seed * 1103515245u + 12345u;
+			a[j] = j % 7 == 0 ? INT16_MIN : j % 11 == 0 ? INT16_MAX :
+					(int16_t)(seed >> 16);
+		}
+		for (j = 0; j < k * n; j++) {
+			seed = seed * 1103515245u + 12345u;
+			b[j] = j % 5 == 0 ? INT16_MIN : j % 13 == 0 ? INT16_MAX :
+					(int16_t)(seed >> 16);
+		}
+		// the last size all minimum, sum over Q15 range
+		if (i == (int)MOSS_ARRAYSIZE(sz) - 1) {
+			for (j = 0; j < m * k; j++) a[j] = INT16_MIN;
+			for (j = 0; j < k * n; j++) b[j] = INT16_MIN;
+		}
+		for (f = 0; f < 2; f++) {
+			moss_matrix_mul_q15_sw(m, k, a, n, b, ref, f);
+			moss_matrix_mul_q15(m, k, a, n, b, c, f);
+			MOSS_UNITEST_ASSERT_RETURN(memcmp(c, ref, sizeof(*c) * m * n)
+					== 0, runner, failed);
+		}
+	}
+	MOSS_UNITEST_ASSERT_RETURN(c[0] == INT16_MAX, runner, failed);
+	return moss_unitest_flag_result_pass;
+}
+
+/* Q31 saturate the accumulator and the result, round half up. */
+static moss_unitest_flag_t test_matrix_q31(moss_unitest_case_t *runner) {
+	static const struct {
+		int32_t a, b;
+		int k;
+		unsigned flag;
+		int32_t c;
+	} cases[] = {
+		{INT32_MIN, INT32_MIN, 1, 0, INT32_MAX},
+		{INT32_MIN, INT32_MIN, 3, moss_q_flag_round, INT32_MAX},
+		{INT32_MIN, INT32_MAX, 3, 0, INT32_MIN},
+		{INT32_MIN, INT32_MAX, 3, moss_q_flag_round, INT32_MIN},
+		{1 << 30, 1, 1, 0, 0},
+		{1 << 30, 1, 1, moss_q_flag_round, 1},
+		{-(1 << 30), 1, 1, 0, -1},
+		{-(1 << 30), 1, 1, moss_q_flag_round, 0},
+		{1 << 30, 1 << 30, 2, 0, 1 << 30},
+	};
+	int32_t a[4], b[4], c;
+	int i, j;
+
+	for (i = 0; i < (int)MOSS_ARRAYSIZE(cases); i++) {
+		for (j = 0; j < cases[i].k; j++) {
+			a[j] = cases[i].a;
+			b[j] = cases[i].b;
+		}
+		moss_matrix_mul_q31(1, cases[i].k, a, 1, b, &c, cases[i].flag);
+		MOSS_UNITEST_ASSERT_RETURN(c == cases[i].c, runner, failed);
+	}
+	return moss_unitest_flag_result_pass;
+}
+
+/* Convert float to Q round to nearest, saturate the limit, NaN to 0. */
+static moss_unitest_flag_t test_matrix_q_float(moss_unitest_case_t *runner) {
+	static const struct {
+		float f;
+		int16_t q15;
+		int32_t q31;
+	} cases[] = {
+		{0.0f, 0, 0},
+		{NAN, 0, 0},
+		{INFINITY, INT16_MAX, INT32_MAX},
+		{-INFINITY, INT16_MIN, INT32_MIN},
+		{1.0f, INT16_MAX, INT32_MAX},
+		{-1.0f, INT16_MIN, INT32_MIN},
+		{2.0f, INT16_MAX, INT32_MAX},
+		{-2.0f, INT16_MIN, INT32_MIN},
+		{0.5f, 16384, 1 << 30},
+		{-0.5f, -16384, -(1 << 30)},
+		/* half of LSB away from zero, just below half not */
+		{0x1p-16f, 1, 32768},
+		{-0x1p-16f, -1, -32768},
+		{0x0.ffffffp-16f, 0, 32768},
+		{0x1p-32f, 0, 1},
+		{-0x1p-32f, 0, -1},
+		{0x0.ffffffp-32f, 0, 0},
+	};
+	int16_t q15;
+	int32_t q31;
+	int i;
+
+	for (i = 0; i < (int)MOSS_ARRAYSIZE(cases); i++) {
+		moss_q15_from_float(&q15, &cases[i].f, 1);
+		moss_q31_from_float(&q31, &cases[i].f, 1);
+		MOSS_UNITEST_ASSERT_RETURN(q15 == cases[i].q15, runner, failed);
+		MOSS_UNITEST_ASSERT_RETURN(q31 == cases[i].q31, runner, failed);
+	}
+	return moss_unitest_flag_result_pass;
+}
+
+void test_matrix_add(moss_unitest_t *suite) {
+	static moss_unitest_t matrix_suite;
+
+	MOSS_UNITEST_INIT2(suite, &matrix_suite, "matrix");
+	MOSS_UNITEST_CASE_INIT4(&matrix_suite, "mul", &test_matrix_mul);
+	MOSS_UNITEST_CASE_INIT4(&matrix_suite, "mul_mt", &test_matrix_mul_mt);
+	MOSS_UNITEST_CASE_INIT4(&matrix_suite, "sgemm", &test_matrix_sgemm);
+	MOSS_UNITEST_CASE_INIT4(&matrix_suite, "q15", &test_matrix_q15);
+	MOSS_UNITEST_CASE_INIT4(&matrix_suite, "q31", &test_matrix_q31);
+	MOSS_UNITEST_CASE_INIT4(&matrix_suite, "q_float", &test_matrix_q_float);
+}
@@ -0,0 +1,33 @@
+#ifndef _H_MOSS_TEST
+#define _H_MOSS_TEST
+
+#include <moss/unitest.h>
+#include <moss/hal/sys.h>
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Monotonic time in nanoseconds for benchmark. */
+static inline unsigned long long test_ns(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/** Add test suite for moss buffer. */
+void test_buf_add(moss_unitest_t *suite);
+
+/** Add test suite for message log. */
+void test_log_add(moss_unitest_t *suite);
+
+/** Add test suite for matrix multiply. */
+void test_matrix_add(moss_unitest_t *suite);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif /* _H_MOSS_TEST */